@@ -0,0 +1,241 @@
+
+/*
+ * The slab allocator contention benchmark: N processes allocate and free
+ * objects of mixed sizes in one shared zone, either under the zone mutex
+ * or under the per size class locks ("slab_class_locks on").
+ *
+ * It is linked with the objects of a configured and built tree, e.g.:
+ *
+ *     ./configure && make
+ *     ar rcs objs/libngx.a $(find objs/src -name '*.o' ! -name nginx.o)
+ *     cc -o slab_bench -I src/core -I src/event -I src/os/unix -I objs \
+ *         contrib/slab_bench/slab_bench.c objs/libngx.a -lpthread -lcrypt
+ *
+ *     ./slab_bench <processes> <0 zone lock | 1 class locks> <operations>
+ *
+ * Each process prints nothing, the parent reports the throughput, the
+ * number of corrupted objects seen, which must be 0, and the zone state
+ * after all objects are freed, the free pages should be back to the
+ * initial number.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <sys/wait.h>
+
+
+#define SLAB_BENCH_ZONE_SIZE  (32 * 1024 * 1024)
+#define SLAB_BENCH_LIVE       64
+
+
+/* the symbols provided by nginx.c */
+
+ngx_module_t  *ngx_modules[] = { NULL };
+ngx_uint_t     ngx_max_module;
+ngx_module_t   ngx_core_module;
+
+
+ngx_pid_t
+ngx_exec_new_binary(ngx_cycle_t *cycle, char *const *argv)
+{
+    return NGX_INVALID_PID;
+}
+
+
+uint64_t
+ngx_get_cpu_affinity(ngx_uint_t n)
+{
+    return 0;
+}
+
+
+char **
+ngx_set_environment(ngx_cycle_t *cycle, ngx_uint_t *last)
+{
+    return NULL;
+}
+
+
+static double
+slab_bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void
+slab_bench_worker(ngx_slab_pool_t *sp, ngx_uint_t k, long ops,
+    ngx_atomic_t *corrupt)
+{
+    long        i;
+    size_t      s, size[SLAB_BENCH_LIVE];
+    u_char     *live[SLAB_BENCH_LIVE];
+    uint64_t    r;
+    ngx_uint_t  j;
+
+    ngx_memzero(live, sizeof(live));
+
+    r = 88172645463325252ULL + k * 7919;
+
+    for (i = 0; i < ops; i++) {
+
+        /* xorshift */
+
+        r ^= r << 13;
+        r ^= r >> 7;
+        r ^= r << 17;
+
+        j = r % SLAB_BENCH_LIVE;
+
+        if (live[j]) {
+            for (s = 0; s < size[j]; s += 8) {
+                if (live[j][s] != (u_char) (k + 1)) {
+                    (void) ngx_atomic_fetch_add(corrupt, 1);
+                    break;
+                }
+            }
+
+            ngx_slab_free(sp, live[j]);
+            live[j] = NULL;
+
+            continue;
+        }
+
+        /* mostly small objects, like rbtree nodes and keys */
+
+        if ((r >> 20) % 100 < 90) {
+            size[j] = 8 + (r >> 32) % 248;
+
+        } else {
+            size[j] = 256 + (r >> 32) % 3000;
+        }
+
+        live[j] = ngx_slab_alloc(sp, size[j]);
+
+        if (live[j] == NULL) {
+            (void) ngx_atomic_fetch_add(corrupt, 1);
+            continue;
+        }
+
+        for (s = 0; s < size[j]; s += 8) {
+            live[j][s] = (u_char) (k + 1);
+        }
+    }
+
+    for (j = 0; j < SLAB_BENCH_LIVE; j++) {
+        if (live[j]) {
+            ngx_slab_free(sp, live[j]);
+        }
+    }
+}
+
+
+int
+main(int argc, char *const *argv)
+{
+    long              ops;
+    double            t;
+    ngx_log_t         log;
+    ngx_uint_t        n, nproc, slot, pfree, used, total, reqs, fails;
+    ngx_cycle_t       cycle;
+    ngx_atomic_t     *corrupt;
+    ngx_open_file_t   file;
+    ngx_slab_pool_t  *sp;
+
+    if (argc != 4) {
+        fprintf(stderr, "usage: slab_bench <processes> <class locks: 0|1>"
+                        " <operations>\n");
+        return 1;
+    }
+
+    nproc = atoi(argv[1]);
+    ops = atol(argv[3]);
+
+    ngx_memzero(&cycle, sizeof(ngx_cycle_t));
+    ngx_memzero(&log, sizeof(ngx_log_t));
+    ngx_memzero(&file, sizeof(ngx_open_file_t));
+
+    file.fd = ngx_stderr;
+    log.file = &file;
+    log.log_level = NGX_LOG_ERR;
+    cycle.log = &log;
+    ngx_cycle = &cycle;
+
+    ngx_pagesize = getpagesize();
+    for (n = ngx_pagesize; n >>= 1; ngx_pagesize_shift++) { /* void */ }
+
+    ngx_ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    ngx_time_init();
+
+    sp = mmap(NULL, SLAB_BENCH_ZONE_SIZE, PROT_READ|PROT_WRITE,
+              MAP_ANON|MAP_SHARED, -1, 0);
+    corrupt = mmap(NULL, ngx_pagesize, PROT_READ|PROT_WRITE,
+                   MAP_ANON|MAP_SHARED, -1, 0);
+
+    if (sp == MAP_FAILED || corrupt == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    sp->end = (u_char *) sp + SLAB_BENCH_ZONE_SIZE;
+    sp->min_shift = 3;
+    sp->addr = sp;
+    sp->class_locks = atoi(argv[2]) ? 1 : 0;
+
+    if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+        return 1;
+    }
+
+    ngx_slab_init(sp);
+
+    pfree = sp->pfree;
+
+    t = slab_bench_now();
+
+    for (n = 0; n < nproc; n++) {
+
+        switch (fork()) {
+
+        case -1:
+            perror("fork");
+            return 1;
+
+        case 0:
+            ngx_pid = getpid();
+            slab_bench_worker(sp, n, ops, corrupt);
+            _exit(0);
+        }
+    }
+
+    while (wait(NULL) > 0) { /* void */ }
+
+    t = slab_bench_now() - t;
+
+    used = 0;
+    total = 0;
+    reqs = 0;
+    fails = 0;
+
+    for (slot = 0; slot < ngx_pagesize_shift - sp->min_shift; slot++) {
+        used += sp->stats[slot].used;
+        total += sp->stats[slot].total;
+        reqs += sp->stats[slot].reqs;
+        fails += sp->stats[slot].fails;
+    }
+
+    printf("%s locks, %lu processes: %.2f Mops/s, corrupt %lu, "
+           "free pages %lu of %lu, used %lu total %lu reqs %lu fails %lu\n",
+           sp->class_locks ? "class" : "zone", (u_long) nproc,
+           nproc * ops / t / 1e6, (u_long) *corrupt,
+           (u_long) sp->pfree, (u_long) pfree, (u_long) used,
+           (u_long) total, (u_long) reqs, (u_long) fails);
+
+    return 0;
+}
@@ -51,6 +51,7 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
     ngx_list_part_t     *part, *opart;
     ngx_open_file_t     *file;
     ngx_listening_t     *ls, *nls;
+    ngx_slab_pool_t     *sp;
     ngx_core_conf_t     *ccf, *old_ccf;
     ngx_core_module_t   *module;
     char                 hostname[NGX_MAXHOSTNAMELEN];
@@ -445,6 +446,17 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
             {
                 shm_zone[i].shm.addr = oshm_zone[n].shm.addr;
 
+                /* the slab locking of a reused zone cannot be changed */
+
+                sp = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
+
+                if (sp->class_locks != (ccf->slab_class_locks ? 1 : 0)) {
+                    ngx_log_error(NGX_LOG_WARN, log, 0,
+                                  "\"slab_class_locks\" is not changed for "
+                                  "the existing shared memory zone \"%V\"",
+                                  &shm_zone[i].shm.name);
+                }
+
                 if (shm_zone[i].init(&shm_zone[i], oshm_zone[n].data)
                     != NGX_OK)
                 {
@@ -493,6 +505,10 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
                     continue;
                 }
 
+                if (ls[i].remain) {
+                    continue;
+                }
+
                 if (ngx_cmp_sockaddr(nls[n].sockaddr, nls[n].socklen,
                                      ls[i].sockaddr, ls[i].socklen, 1)
                     == NGX_OK)
@@ -505,6 +521,12 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
                         nls[n].listen = 1;
                     }
 
+#if (NGX_HAVE_REUSEPORT)
+                    if (nls[n].reuseport && !ls[i].reuseport) {
+                        nls[n].add_reuseport = 1;
+                    }
+#endif
+
 #if (NGX_HAVE_DEFERRED_ACCEPT && defined SO_ACCEPTFILTER)
 
                     /*
@@ -853,6 +875,7 @@ static ngx_int_t
 ngx_init_zone_pool(ngx_cycle_t *cycle, ngx_shm_zone_t *zn)
 {
     u_char           *file;
+    ngx_core_conf_t  *ccf;
     ngx_slab_pool_t  *sp;
 
     sp = (ngx_slab_pool_t *) zn->shm.addr;
@@ -873,6 +896,10 @@ ngx_init_zone_pool(ngx_cycle_t *cycle, ngx_shm_zone_t *zn)
     sp->min_shift = 3;
     sp->addr = zn->shm.addr;
 
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    sp->class_locks = ccf->slab_class_locks ? 1 : 0;
+
 #if (NGX_HAVE_ATOMIC_OPS)
 
     file = NULL;
@@ -1227,6 +1254,7 @@ ngx_shared_memory_add(ngx_conf_t *cf, ngx_str_t *name, size_t size, void *tag)
     shm_zone->shm.name = *name;
     shm_zone->shm.exists = 0;
     shm_zone->init = NULL;
+    shm_zone->unlock = NULL;
     shm_zone->tag = tag;
 
     return shm_zone;
@@ -25,11 +25,13 @@
 typedef struct ngx_shm_zone_s  ngx_shm_zone_t;
 
 typedef ngx_int_t (*ngx_shm_zone_init_pt) (ngx_shm_zone_t *zone, void *data);
+typedef void (*ngx_shm_zone_unlock_pt) (ngx_shm_zone_t *zone, ngx_pid_t pid);
 
 struct ngx_shm_zone_s {
     void                     *data;
     ngx_shm_t                 shm;
     ngx_shm_zone_init_pt      init;
+    ngx_shm_zone_unlock_pt    unlock;
     void                     *tag;
 };
 
@@ -85,6 +87,10 @@ typedef struct {
      ngx_int_t                rlimit_sigpending;
      off_t                    rlimit_core;
 
+     size_t                   pool_cache_size;
+
+     ngx_flag_t               slab_class_locks;
+
      int                      priority;
 
      ngx_uint_t               cpu_affinity_n;
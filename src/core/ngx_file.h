@@ -27,6 +27,13 @@ struct ngx_file_s {
     ngx_event_aio_t           *aio;
 #endif
 
+#if (NGX_THREAD_POOL)
+    ngx_int_t                (*thread_handler)(ngx_thread_task_t *task,
+                                               ngx_file_t *file);
+    void                      *thread_ctx;
+    ngx_thread_task_t         *thread_task;
+#endif
+
     unsigned                   valid_info:1;
     unsigned                   directio:1;
 };
@@ -71,6 +78,7 @@ typedef struct {
     unsigned                   log_level:8;
     unsigned                   persistent:1;
     unsigned                   clean:1;
+    unsigned                   thread_write:1;
 } ngx_temp_file_t;
 
 
@@ -81,7 +81,7 @@ ngx_output_chain(ngx_output_chain_ctx_t *ctx, ngx_chain_t *in)
 
     for ( ;; ) {
 
-#if (NGX_HAVE_FILE_AIO)
+#if (NGX_HAVE_FILE_AIO || NGX_THREAD_POOL)
         if (ctx->aio) {
             return NGX_AGAIN;
         }
@@ -532,15 +532,35 @@ ngx_output_chain_copy_buf(ngx_output_chain_ctx_t *ctx)
                 return NGX_AGAIN;
             }
 
-        } else {
-            n = ngx_read_file(src->file, dst->pos, (size_t) size,
-                              src->file_pos);
-        }
-#else
+        } else
+#endif
+#if (NGX_THREAD_POOL)
+
+        if (ctx->thread_handler) {
 
-        n = ngx_read_file(src->file, dst->pos, (size_t) size, src->file_pos);
+            /*
+             * the file may be shared with other readers and writers,
+             * e.g. an upstream temporary file, so the task is kept
+             * in the context rather than in the file
+             */
 
+            src->file->thread_task = ctx->thread_task;
+            src->file->thread_handler = ctx->thread_handler;
+            src->file->thread_ctx = ctx->filter_ctx;
+
+            n = ngx_thread_read(src->file, dst->pos, (size_t) size,
+                                src->file_pos, ctx->pool);
+            if (n == NGX_AGAIN) {
+                ctx->thread_task = src->file->thread_task;
+                return NGX_AGAIN;
+            }
+
+        } else
 #endif
+        {
+            n = ngx_read_file(src->file, dst->pos, (size_t) size,
+                              src->file_pos);
+        }
 
 #if (NGX_HAVE_ALIGNED_DIRECTIO)
 
@@ -11,14 +11,30 @@
 
 static void *ngx_palloc_block(ngx_pool_t *pool, size_t size);
 static void *ngx_palloc_large(ngx_pool_t *pool, size_t size);
+static size_t ngx_pool_cache_round(size_t size);
+static void *ngx_pool_cache_alloc(size_t size, ngx_log_t *log);
+static void ngx_pool_cache_free(void *p, size_t size);
+
+
+ngx_pool_cache_t  ngx_pool_cache;
 
 
 ngx_pool_t *
 ngx_create_pool(size_t size, ngx_log_t *log)
 {
+    size_t       csize;
     ngx_pool_t  *p;
 
-    p = ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    csize = ngx_pool_cache_round(size);
+
+    if (csize) {
+        size = csize;
+        p = ngx_pool_cache_alloc(size, log);
+
+    } else {
+        p = ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    }
+
     if (p == NULL) {
         return NULL;
     }
@@ -61,7 +77,7 @@ ngx_destroy_pool(ngx_pool_t *pool)
         ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0, "free: %p", l->alloc);
 
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_pool_cache_free(l->alloc, l->size);
         }
     }
 
@@ -84,7 +100,7 @@ ngx_destroy_pool(ngx_pool_t *pool)
 #endif
 
     for (p = pool, n = pool->d.next; /* void */; p = n, n = n->d.next) {
-        ngx_free(p);
+        ngx_pool_cache_free(p, (size_t) (p->d.end - (u_char *) p));
 
         if (n == NULL) {
             break;
@@ -101,7 +117,7 @@ ngx_reset_pool(ngx_pool_t *pool)
 
     for (l = pool->large; l; l = l->next) {
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_pool_cache_free(l->alloc, l->size);
         }
     }
 
@@ -185,7 +201,13 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
 
     psize = (size_t) (pool->d.end - (u_char *) pool);
 
-    m = ngx_memalign(NGX_POOL_ALIGNMENT, psize, pool->log);
+    if (ngx_pool_cache_round(psize) == psize) {
+        m = ngx_pool_cache_alloc(psize, pool->log);
+
+    } else {
+        m = ngx_memalign(NGX_POOL_ALIGNMENT, psize, pool->log);
+    }
+
     if (m == NULL) {
         return NULL;
     }
@@ -220,10 +242,19 @@ static void *
 ngx_palloc_large(ngx_pool_t *pool, size_t size)
 {
     void              *p;
+    size_t             csize;
     ngx_uint_t         n;
     ngx_pool_large_t  *large;
 
-    p = ngx_alloc(size, pool->log);
+    csize = ngx_pool_cache_round(size);
+
+    if (csize) {
+        p = ngx_pool_cache_alloc(csize, pool->log);
+
+    } else {
+        p = ngx_alloc(size, pool->log);
+    }
+
     if (p == NULL) {
         return NULL;
     }
@@ -233,6 +264,7 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     for (large = pool->large; large; large = large->next) {
         if (large->alloc == NULL) {
             large->alloc = p;
+            large->size = csize;
             return p;
         }
 
@@ -243,11 +275,12 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
 
     large = ngx_palloc(pool, sizeof(ngx_pool_large_t));
     if (large == NULL) {
-        ngx_free(p);
+        ngx_pool_cache_free(p, csize);
         return NULL;
     }
 
     large->alloc = p;
+    large->size = csize;
     large->next = pool->large;
     pool->large = large;
 
@@ -273,6 +306,7 @@ ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment)
     }
 
     large->alloc = p;
+    large->size = 0;
     large->next = pool->large;
     pool->large = large;
 
@@ -289,7 +323,7 @@ ngx_pfree(ngx_pool_t *pool, void *p)
         if (p == l->alloc) {
             ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
                            "free: %p", l->alloc);
-            ngx_free(l->alloc);
+            ngx_pool_cache_free(l->alloc, l->size);
             l->alloc = NULL;
 
             return NGX_OK;
@@ -300,6 +334,90 @@ ngx_pfree(ngx_pool_t *pool, void *p)
 }
 
 
+/*
+ * the pool blocks and the large allocations are rounded up to a power of two
+ * size class while the cache is enabled, so the memory freed by one request
+ * is already faulted in when the next one takes it from the class list
+ */
+
+static size_t
+ngx_pool_cache_round(size_t size)
+{
+    size_t  csize;
+
+    if (ngx_pool_cache.max == 0 || size > NGX_POOL_CACHE_MAX) {
+        return 0;
+    }
+
+    for (csize = NGX_POOL_CACHE_MIN; csize < size; csize <<= 1) {
+        /* void */
+    }
+
+    return csize;
+}
+
+
+static ngx_uint_t
+ngx_pool_cache_class(size_t size)
+{
+    ngx_uint_t  n;
+
+    for (n = 0; (size_t) NGX_POOL_CACHE_MIN << n < size; n++) {
+        /* void */
+    }
+
+    return n;
+}
+
+
+static void *
+ngx_pool_cache_alloc(size_t size, ngx_log_t *log)
+{
+    void  **slot, *p;
+
+    slot = &ngx_pool_cache.free[ngx_pool_cache_class(size)];
+
+    p = *slot;
+
+    if (p) {
+        *slot = *(void **) p;
+        ngx_pool_cache.size -= size;
+        ngx_pool_cache.hits++;
+
+        return p;
+    }
+
+    ngx_pool_cache.misses++;
+
+    return ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+}
+
+
+static void
+ngx_pool_cache_free(void *p, size_t size)
+{
+    void  **slot;
+
+    if (size == 0 || ngx_pool_cache_round(size) != size) {
+        ngx_free(p);
+        return;
+    }
+
+    if (ngx_pool_cache.size + size > ngx_pool_cache.max) {
+        ngx_pool_cache.overflows++;
+        ngx_free(p);
+        return;
+    }
+
+    slot = &ngx_pool_cache.free[ngx_pool_cache_class(size)];
+
+    *(void **) p = *slot;
+    *slot = p;
+
+    ngx_pool_cache.size += size;
+}
+
+
 void *
 ngx_pcalloc(ngx_pool_t *pool, size_t size)
 {
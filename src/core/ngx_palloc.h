@@ -26,6 +26,17 @@
     ngx_align((sizeof(ngx_pool_t) + 2 * sizeof(ngx_pool_large_t)),            \
               NGX_POOL_ALIGNMENT)
 
+/*
+ * the freed pool blocks and large allocations of up to NGX_POOL_CACHE_MAX
+ * bytes are kept in per process lists of power of two size classes
+ */
+#define NGX_POOL_CACHE_MIN_SHIFT 6
+#define NGX_POOL_CACHE_MAX_SHIFT 16
+#define NGX_POOL_CACHE_MIN       (1 << NGX_POOL_CACHE_MIN_SHIFT)
+#define NGX_POOL_CACHE_MAX       (1 << NGX_POOL_CACHE_MAX_SHIFT)
+#define NGX_POOL_CACHE_CLASSES                                                \
+    (NGX_POOL_CACHE_MAX_SHIFT - NGX_POOL_CACHE_MIN_SHIFT + 1)
+
 
 typedef void (*ngx_pool_cleanup_pt)(void *data);
 
@@ -43,6 +54,7 @@ typedef struct ngx_pool_large_s  ngx_pool_large_t;
 struct ngx_pool_large_s {
     ngx_pool_large_t     *next;
     void                 *alloc;
+    size_t                size;    /* a cache class size or 0 */
 };
 
 
@@ -72,6 +84,18 @@ typedef struct {
 } ngx_pool_cleanup_file_t;
 
 
+typedef struct {
+    size_t                max;      /* 0 disables the cache */
+    size_t                size;     /* the bytes held in the lists */
+
+    ngx_uint_t            hits;
+    ngx_uint_t            misses;
+    ngx_uint_t            overflows;
+
+    void                 *free[NGX_POOL_CACHE_CLASSES];
+} ngx_pool_cache_t;
+
+
 void *ngx_alloc(size_t size, ngx_log_t *log);
 void *ngx_calloc(size_t size, ngx_log_t *log);
 
@@ -92,4 +116,8 @@ void ngx_pool_cleanup_file(void *data);
 void ngx_pool_delete_file(void *data);
 
 
+/* the cache is not locked, pools must not be used by the pool threads */
+extern ngx_pool_cache_t  ngx_pool_cache;
+
+
 #endif /* _NGX_PALLOC_H_INCLUDED_ */
@@ -106,6 +106,33 @@ ngx_slab_init(ngx_slab_pool_t *pool)
 
     p += n * sizeof(ngx_slab_page_t);
 
+    pool->stats = (ngx_slab_stat_t *) p;
+    ngx_memzero(pool->stats, n * sizeof(ngx_slab_stat_t));
+
+    p += n * sizeof(ngx_slab_stat_t);
+
+    pool->locks = NULL;
+
+#if (NGX_HAVE_ATOMIC_OPS)
+
+    if (pool->class_locks) {
+        pool->locks = (ngx_slab_lock_t *) p;
+
+        for (i = 0; i < n; i++) {
+            ngx_memzero(&pool->locks[i], sizeof(ngx_slab_lock_t));
+            (void) ngx_shmtx_create(&pool->locks[i].mutex,
+                                    &pool->locks[i].lock, NULL);
+        }
+
+        p += n * sizeof(ngx_slab_lock_t);
+
+        ngx_memzero(&pool->pages_lock, sizeof(ngx_slab_lock_t));
+        (void) ngx_shmtx_create(&pool->pages_lock.mutex,
+                                &pool->pages_lock.lock, NULL);
+    }
+
+#endif
+
     pages = (ngx_uint_t) (size / (ngx_pagesize + sizeof(ngx_slab_page_t)));
 
     ngx_memzero(p, pages * sizeof(ngx_slab_page_t));
@@ -129,6 +156,8 @@ ngx_slab_init(ngx_slab_pool_t *pool)
         pool->pages->slab = pages;
     }
 
+    pool->pfree = pages;
+
     pool->log_nomem = 1;
     pool->log_ctx = &pool->zero;
     pool->zero = '\0';
@@ -140,6 +169,10 @@ ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 {
     void  *p;
 
+    if (pool->locks) {
+        return ngx_slab_alloc_locked(pool, size);
+    }
+
     ngx_shmtx_lock(&pool->mutex);
 
     p = ngx_slab_alloc_locked(pool, size);
@@ -156,6 +189,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
     size_t            s;
     uintptr_t         p, n, m, mask, *bitmap;
     ngx_uint_t        i, slot, shift, map;
+    ngx_slab_stat_t  *stat;
     ngx_slab_page_t  *page, *prev, *slots;
 
     if (size >= ngx_slab_max_size) {
@@ -173,7 +207,10 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
             p = 0;
         }
 
-        goto done;
+        ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                       "slab alloc: %p", p);
+
+        return (void *) p;
     }
 
     if (size > pool->min_size) {
@@ -190,6 +227,12 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
     ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
                    "slab alloc: %uz slot: %ui", size, slot);
 
+    if (pool->locks) {
+        ngx_shmtx_lock(&pool->locks[slot].mutex);
+    }
+
+    stat = &pool->stats[slot];
+
     slots = (ngx_slab_page_t *) ((u_char *) pool + sizeof(ngx_slab_pool_t));
     page = slots[slot].next;
 
@@ -341,6 +384,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
             bitmap[0] = (2 << n) - 1;
 
+            stat->total += (ngx_pagesize >> shift) - n;
+
             map = (1 << (ngx_pagesize_shift - shift)) / (sizeof(uintptr_t) * 8);
 
             for (i = 1; i < map; i++) {
@@ -364,6 +409,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
             page->next = &slots[slot];
             page->prev = (uintptr_t) &slots[slot] | NGX_SLAB_EXACT;
 
+            stat->total += 8 * sizeof(uintptr_t);
+
             slots[slot].next = page;
 
             p = (page - pool->pages) << ngx_pagesize_shift;
@@ -377,6 +424,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
             page->next = &slots[slot];
             page->prev = (uintptr_t) &slots[slot] | NGX_SLAB_BIG;
 
+            stat->total += ngx_pagesize >> shift;
+
             slots[slot].next = page;
 
             p = (page - pool->pages) << ngx_pagesize_shift;
@@ -390,6 +439,19 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
 done:
 
+    stat->reqs++;
+
+    if (p) {
+        stat->used++;
+
+    } else {
+        stat->fails++;
+    }
+
+    if (pool->locks) {
+        ngx_shmtx_unlock(&pool->locks[slot].mutex);
+    }
+
     ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0, "slab alloc: %p", p);
 
     return (void *) p;
@@ -399,6 +461,11 @@ done:
 void
 ngx_slab_free(ngx_slab_pool_t *pool, void *p)
 {
+    if (pool->locks) {
+        ngx_slab_free_locked(pool, p);
+        return;
+    }
+
     ngx_shmtx_lock(&pool->mutex);
 
     ngx_slab_free_locked(pool, p);
@@ -413,25 +480,55 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
     size_t            size;
     uintptr_t         slab, m, *bitmap;
     ngx_uint_t        n, type, slot, shift, map;
+    ngx_slab_stat_t  *stat;
     ngx_slab_page_t  *slots, *page;
 
     ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0, "slab free: %p", p);
 
     if ((u_char *) p < pool->start || (u_char *) p > pool->end) {
         ngx_slab_error(pool, NGX_LOG_ALERT, "ngx_slab_free(): outside of pool");
-        goto fail;
+        return;
     }
 
     n = ((u_char *) p - pool->start) >> ngx_pagesize_shift;
     page = &pool->pages[n];
-    slab = page->slab;
+
+    /*
+     * the type and the shift of a page cannot change while the page
+     * has the chunk being freed, so they are read before the class lock
+     */
+
     type = page->prev & NGX_SLAB_PAGE_MASK;
 
     switch (type) {
 
+    case NGX_SLAB_SMALL:
+    case NGX_SLAB_BIG:
+        shift = page->slab & NGX_SLAB_SHIFT_MASK;
+        break;
+
+    case NGX_SLAB_EXACT:
+        shift = ngx_slab_exact_shift;
+        break;
+
+    default: /* NGX_SLAB_PAGE */
+        shift = ngx_pagesize_shift;
+        break;
+    }
+
+    slot = shift - pool->min_shift;
+    stat = &pool->stats[slot];
+
+    if (pool->locks && type != NGX_SLAB_PAGE) {
+        ngx_shmtx_lock(&pool->locks[slot].mutex);
+    }
+
+    slab = page->slab;
+
+    switch (type) {
+
     case NGX_SLAB_SMALL:
 
-        shift = slab & NGX_SLAB_SHIFT_MASK;
         size = 1 << shift;
 
         if ((uintptr_t) p & (size - 1)) {
@@ -446,10 +543,11 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
         if (bitmap[n] & m) {
 
+            stat->used--;
+
             if (page->next == NULL) {
                 slots = (ngx_slab_page_t *)
                                    ((u_char *) pool + sizeof(ngx_slab_pool_t));
-                slot = shift - pool->min_shift;
 
                 page->next = slots[slot].next;
                 slots[slot].next = page;
@@ -478,6 +576,14 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
                 }
             }
 
+            n = (1 << (ngx_pagesize_shift - shift)) / 8 / (1 << shift);
+
+            if (n == 0) {
+                n = 1;
+            }
+
+            stat->total -= (ngx_pagesize >> shift) - n;
+
             ngx_slab_free_pages(pool, page, 1);
 
             goto done;
@@ -496,10 +602,11 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
         }
 
         if (slab & m) {
+            stat->used--;
+
             if (slab == NGX_SLAB_BUSY) {
                 slots = (ngx_slab_page_t *)
                                    ((u_char *) pool + sizeof(ngx_slab_pool_t));
-                slot = ngx_slab_exact_shift - pool->min_shift;
 
                 page->next = slots[slot].next;
                 slots[slot].next = page;
@@ -514,6 +621,8 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
                 goto done;
             }
 
+            stat->total -= 8 * sizeof(uintptr_t);
+
             ngx_slab_free_pages(pool, page, 1);
 
             goto done;
@@ -523,7 +632,6 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
     case NGX_SLAB_BIG:
 
-        shift = slab & NGX_SLAB_SHIFT_MASK;
         size = 1 << shift;
 
         if ((uintptr_t) p & (size - 1)) {
@@ -535,10 +643,11 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
         if (slab & m) {
 
+            stat->used--;
+
             if (page->next == NULL) {
                 slots = (ngx_slab_page_t *)
                                    ((u_char *) pool + sizeof(ngx_slab_pool_t));
-                slot = shift - pool->min_shift;
 
                 page->next = slots[slot].next;
                 slots[slot].next = page;
@@ -553,6 +662,8 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
                 goto done;
             }
 
+            stat->total -= ngx_pagesize >> shift;
+
             ngx_slab_free_pages(pool, page, 1);
 
             goto done;
@@ -596,6 +707,10 @@ done:
 
     ngx_slab_junk(p, size);
 
+    if (pool->locks) {
+        ngx_shmtx_unlock(&pool->locks[slot].mutex);
+    }
+
     return;
 
 wrong_chunk:
@@ -612,6 +727,10 @@ chunk_already_free:
 
 fail:
 
+    if (pool->locks && type != NGX_SLAB_PAGE) {
+        ngx_shmtx_unlock(&pool->locks[slot].mutex);
+    }
+
     return;
 }
 
@@ -621,10 +740,16 @@ ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
 {
     ngx_slab_page_t  *page, *p;
 
+    if (pool->locks) {
+        ngx_shmtx_lock(&pool->pages_lock.mutex);
+    }
+
     for (page = pool->free.next; page != &pool->free; page = page->next) {
 
         if (page->slab >= pages) {
 
+            pool->pfree -= pages;
+
             if (page->slab > pages) {
                 page[pages].slab = page->slab - pages;
                 page[pages].next = page->next;
@@ -644,21 +769,24 @@ ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
             page->next = NULL;
             page->prev = NGX_SLAB_PAGE;
 
-            if (--pages == 0) {
-                return page;
-            }
-
-            for (p = page + 1; pages; pages--) {
+            for (p = page + 1; --pages; p++) {
                 p->slab = NGX_SLAB_PAGE_BUSY;
                 p->next = NULL;
                 p->prev = NGX_SLAB_PAGE;
-                p++;
+            }
+
+            if (pool->locks) {
+                ngx_shmtx_unlock(&pool->pages_lock.mutex);
             }
 
             return page;
         }
     }
 
+    if (pool->locks) {
+        ngx_shmtx_unlock(&pool->pages_lock.mutex);
+    }
+
     if (pool->log_nomem) {
         ngx_slab_error(pool, NGX_LOG_CRIT,
                        "ngx_slab_alloc() failed: no memory");
@@ -674,11 +802,7 @@ ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
 {
     ngx_slab_page_t  *prev;
 
-    page->slab = pages--;
-
-    if (pages) {
-        ngx_memzero(&page[1], pages * sizeof(ngx_slab_page_t));
-    }
+    /* a chunk page is unlinked from its size class under the class lock */
 
     if (page->next) {
         prev = (ngx_slab_page_t *) (page->prev & ~NGX_SLAB_PAGE_MASK);
@@ -686,12 +810,55 @@ ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
         page->next->prev = page->prev;
     }
 
+    if (pool->locks) {
+        ngx_shmtx_lock(&pool->pages_lock.mutex);
+    }
+
+    pool->pfree += pages;
+
+    page->slab = pages--;
+
+    if (pages) {
+        ngx_memzero(&page[1], pages * sizeof(ngx_slab_page_t));
+    }
+
     page->prev = (uintptr_t) &pool->free;
     page->next = pool->free.next;
 
     page->next->prev = (uintptr_t) page;
 
     pool->free.next = page;
+
+    if (pool->locks) {
+        ngx_shmtx_unlock(&pool->pages_lock.mutex);
+    }
+}
+
+
+ngx_uint_t
+ngx_slab_force_unlock(ngx_slab_pool_t *pool, ngx_pid_t pid)
+{
+    ngx_uint_t  i, n, unlocked;
+
+    unlocked = ngx_shmtx_force_unlock(&pool->mutex, pid);
+
+    if (pool->locks == NULL) {
+        return unlocked;
+    }
+
+    n = ngx_pagesize_shift - pool->min_shift;
+
+    for (i = 0; i < n; i++) {
+        if (ngx_shmtx_force_unlock(&pool->locks[i].mutex, pid)) {
+            unlocked = 1;
+        }
+    }
+
+    if (ngx_shmtx_force_unlock(&pool->pages_lock.mutex, pid)) {
+        unlocked = 1;
+    }
+
+    return unlocked;
 }
 
 
@@ -22,6 +22,21 @@ struct ngx_slab_page_s {
 };
 
 
+typedef struct {
+    ngx_uint_t        total;
+    ngx_uint_t        used;
+
+    ngx_uint_t        reqs;
+    ngx_uint_t        fails;
+} ngx_slab_stat_t;
+
+
+typedef struct {
+    ngx_shmtx_sh_t    lock;
+    ngx_shmtx_t       mutex;
+} ngx_slab_lock_t;
+
+
 typedef struct {
     ngx_shmtx_sh_t    lock;
 
@@ -31,15 +46,28 @@ typedef struct {
     ngx_slab_page_t  *pages;
     ngx_slab_page_t   free;
 
+    ngx_slab_stat_t  *stats;
+    ngx_uint_t        pfree;
+
     u_char           *start;
     u_char           *end;
 
     ngx_shmtx_t       mutex;
 
+    /*
+     * with class_locks set before ngx_slab_init() each size class and
+     * the free pages have their own locks, and the pool mutex is left
+     * to the zone users
+     */
+
+    ngx_slab_lock_t  *locks;
+    ngx_slab_lock_t   pages_lock;
+
     u_char           *log_ctx;
     u_char            zero;
 
     unsigned          log_nomem:1;
+    unsigned          class_locks:1;
 
     void             *data;
     void             *addr;
@@ -51,6 +79,7 @@ void *ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
 void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
+ngx_uint_t ngx_slab_force_unlock(ngx_slab_pool_t *pool, ngx_pid_t pid);
 
 
 #endif /* _NGX_SLAB_H_INCLUDED_ */
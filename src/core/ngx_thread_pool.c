@@ -0,0 +1,690 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <ngx_channel.h>
+#include <ngx_thread_pool.h>
+
+#include <pthread.h>
+
+
+#if !(NGX_HAVE_ATOMIC_OPS)
+#error the thread pool requires ngx_atomic_cmp_set()
+#endif
+
+
+typedef struct {
+    ngx_array_t               pools;
+} ngx_thread_pool_conf_t;
+
+
+typedef struct {
+    ngx_thread_task_t        *first;
+    ngx_thread_task_t       **last;
+} ngx_thread_pool_queue_t;
+
+#define ngx_thread_pool_queue_init(q)                                         \
+    (q)->first = NULL;                                                        \
+    (q)->last = &(q)->first
+
+
+struct ngx_thread_pool_s {
+    pthread_mutex_t           mtx;
+    pthread_cond_t            cond;
+    ngx_thread_pool_queue_t   queue;
+    ngx_int_t                 waiting;
+    ngx_uint_t                exiting;
+
+    pthread_t                *tids;
+    ngx_uint_t                running;
+
+    ngx_log_t                *log;
+
+    ngx_str_t                 name;
+    ngx_uint_t                threads;
+    ngx_int_t                 max_queue;
+
+    u_char                   *file;
+    ngx_uint_t                line;
+};
+
+
+static ngx_int_t ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log,
+    ngx_pool_t *pool);
+static void ngx_thread_pool_destroy(ngx_thread_pool_t *tp);
+
+static void *ngx_thread_pool_cycle(void *data);
+static void ngx_thread_pool_handler(ngx_event_t *ev);
+
+static char *ngx_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+
+static void *ngx_thread_pool_create_conf(ngx_cycle_t *cycle);
+static char *ngx_thread_pool_init_conf(ngx_cycle_t *cycle, void *conf);
+
+static ngx_int_t ngx_thread_pool_init_worker(ngx_cycle_t *cycle);
+static void ngx_thread_pool_exit_worker(ngx_cycle_t *cycle);
+
+
+static ngx_command_t  ngx_thread_pool_commands[] = {
+
+    { ngx_string("thread_pool"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE23,
+      ngx_thread_pool,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_core_module_t  ngx_thread_pool_module_ctx = {
+    ngx_string("thread_pool"),
+    ngx_thread_pool_create_conf,
+    ngx_thread_pool_init_conf
+};
+
+
+ngx_module_t  ngx_thread_pool_module = {
+    NGX_MODULE_V1,
+    &ngx_thread_pool_module_ctx,           /* module context */
+    ngx_thread_pool_commands,              /* module directives */
+    NGX_CORE_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_thread_pool_init_worker,           /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    ngx_thread_pool_exit_worker,           /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_str_t  ngx_thread_pool_default = ngx_string("default");
+
+static ngx_uint_t               ngx_thread_pool_task_id;
+
+/*
+ * the completed tasks are pushed by the threads onto a lock-free stack,
+ * the thread that finds the stack empty wakes up the event loop through
+ * an eventfd (or a pipe where eventfd is not available) that is handled
+ * as a channel, and the worker takes the whole stack at once
+ */
+
+static ngx_atomic_t             ngx_thread_pool_done;
+static ngx_fd_t                 ngx_thread_pool_notify[2] = { -1, -1 };
+
+
+static ngx_int_t
+ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log, ngx_pool_t *pool)
+{
+    int             err;
+    sigset_t        set, old;
+    ngx_uint_t      n;
+    pthread_attr_t  attr;
+
+    ngx_thread_pool_queue_init(&tp->queue);
+
+    err = pthread_mutex_init(&tp->mtx, NULL);
+    if (err) {
+        ngx_log_error(NGX_LOG_EMERG, log, err, "pthread_mutex_init() failed");
+        return NGX_ERROR;
+    }
+
+    err = pthread_cond_init(&tp->cond, NULL);
+    if (err) {
+        ngx_log_error(NGX_LOG_EMERG, log, err, "pthread_cond_init() failed");
+        (void) pthread_mutex_destroy(&tp->mtx);
+        return NGX_ERROR;
+    }
+
+    tp->log = log;
+
+    tp->tids = ngx_pcalloc(pool, tp->threads * sizeof(pthread_t));
+    if (tp->tids == NULL) {
+        return NGX_ERROR;
+    }
+
+    err = pthread_attr_init(&attr);
+    if (err) {
+        ngx_log_error(NGX_LOG_EMERG, log, err, "pthread_attr_init() failed");
+        return NGX_ERROR;
+    }
+
+    /* the threads must not handle the signals sent to the worker */
+
+    sigfillset(&set);
+    sigdelset(&set, SIGILL);
+    sigdelset(&set, SIGFPE);
+    sigdelset(&set, SIGSEGV);
+    sigdelset(&set, SIGBUS);
+
+    err = pthread_sigmask(SIG_BLOCK, &set, &old);
+    if (err) {
+        ngx_log_error(NGX_LOG_EMERG, log, err, "pthread_sigmask() failed");
+        (void) pthread_attr_destroy(&attr);
+        return NGX_ERROR;
+    }
+
+    for (n = 0; n < tp->threads; n++) {
+        err = pthread_create(&tp->tids[n], &attr, ngx_thread_pool_cycle, tp);
+        if (err) {
+            ngx_log_error(NGX_LOG_EMERG, log, err,
+                          "pthread_create() failed");
+            break;
+        }
+
+        tp->running++;
+    }
+
+    (void) pthread_sigmask(SIG_SETMASK, &old, NULL);
+    (void) pthread_attr_destroy(&attr);
+
+    return (n == tp->threads) ? NGX_OK : NGX_ERROR;
+}
+
+
+static void
+ngx_thread_pool_destroy(ngx_thread_pool_t *tp)
+{
+    ngx_uint_t  n;
+
+    if (tp->tids == NULL) {
+        return;
+    }
+
+    (void) pthread_mutex_lock(&tp->mtx);
+
+    tp->exiting = 1;
+
+    (void) pthread_cond_broadcast(&tp->cond);
+    (void) pthread_mutex_unlock(&tp->mtx);
+
+    for (n = 0; n < tp->running; n++) {
+        (void) pthread_join(tp->tids[n], NULL);
+    }
+
+    tp->running = 0;
+
+    (void) pthread_cond_destroy(&tp->cond);
+    (void) pthread_mutex_destroy(&tp->mtx);
+}
+
+
+ngx_thread_task_t *
+ngx_thread_task_alloc(ngx_pool_t *pool, size_t size)
+{
+    ngx_thread_task_t  *task;
+
+    task = ngx_pcalloc(pool, sizeof(ngx_thread_task_t) + size);
+    if (task == NULL) {
+        return NULL;
+    }
+
+    task->ctx = task + 1;
+
+    return task;
+}
+
+
+ngx_int_t
+ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
+{
+    if (task->event.active) {
+        ngx_log_error(NGX_LOG_ALERT, tp->log, 0,
+                      "task #%ui already active", task->id);
+        return NGX_ERROR;
+    }
+
+    if (pthread_mutex_lock(&tp->mtx) != 0) {
+        return NGX_ERROR;
+    }
+
+    if (tp->waiting >= tp->max_queue) {
+        (void) pthread_mutex_unlock(&tp->mtx);
+
+        ngx_log_error(NGX_LOG_ERR, tp->log, 0,
+                      "thread pool \"%V\" queue overflow: %i tasks waiting",
+                      &tp->name, tp->waiting);
+        return NGX_ERROR;
+    }
+
+    task->event.active = 1;
+
+    task->id = ngx_thread_pool_task_id++;
+    task->next = NULL;
+
+    *tp->queue.last = task;
+    tp->queue.last = &task->next;
+
+    tp->waiting++;
+
+    (void) pthread_cond_signal(&tp->cond);
+    (void) pthread_mutex_unlock(&tp->mtx);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, tp->log, 0,
+                   "task #%ui added to thread pool \"%V\"",
+                   task->id, &tp->name);
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_thread_pool_cycle(void *data)
+{
+    ngx_thread_pool_t *tp = data;
+
+    ngx_atomic_uint_t   last;
+    ngx_thread_task_t  *task;
+#if (NGX_HAVE_SYS_EVENTFD_H)
+    uint64_t            n;
+#endif
+
+    for ( ;; ) {
+        if (pthread_mutex_lock(&tp->mtx) != 0) {
+            return NULL;
+        }
+
+        while (tp->queue.first == NULL && !tp->exiting) {
+            (void) pthread_cond_wait(&tp->cond, &tp->mtx);
+        }
+
+        task = tp->queue.first;
+
+        if (task == NULL) {
+            (void) pthread_mutex_unlock(&tp->mtx);
+            return NULL;
+        }
+
+        tp->queue.first = task->next;
+
+        if (tp->queue.first == NULL) {
+            tp->queue.last = &tp->queue.first;
+        }
+
+        tp->waiting--;
+
+        (void) pthread_mutex_unlock(&tp->mtx);
+
+        task->handler(task->ctx, tp->log);
+
+        do {
+            last = ngx_thread_pool_done;
+            task->next = (ngx_thread_task_t *) last;
+
+        } while (!ngx_atomic_cmp_set(&ngx_thread_pool_done, last,
+                                     (ngx_atomic_uint_t) task));
+
+        if (last) {
+            /* the worker has not taken the stack yet, a wakeup is pending */
+            continue;
+        }
+
+#if (NGX_HAVE_SYS_EVENTFD_H)
+        n = 1;
+
+        if (write(ngx_thread_pool_notify[1], &n, sizeof(uint64_t))
+            != sizeof(uint64_t))
+        {
+            /* the counter cannot overflow with the worker reading it */
+        }
+#else
+        if (write(ngx_thread_pool_notify[1], "", 1) != 1) {
+            /* a full pipe already has a wakeup pending */
+        }
+#endif
+    }
+}
+
+
+static void
+ngx_thread_pool_handler(ngx_event_t *ev)
+{
+    ngx_event_t        *event;
+    ngx_atomic_uint_t   last;
+    ngx_connection_t   *c;
+    ngx_thread_task_t  *task, *next;
+#if (NGX_HAVE_SYS_EVENTFD_H)
+    uint64_t            n;
+#else
+    u_char              buf[64];
+#endif
+
+    c = ev->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ev->log, 0, "thread pool handler");
+
+#if (NGX_HAVE_SYS_EVENTFD_H)
+    if (read(c->fd, &n, sizeof(uint64_t)) != sizeof(uint64_t)) {
+        /* a spurious wakeup */
+    }
+#else
+    while (read(c->fd, buf, sizeof(buf)) == sizeof(buf)) {
+        /* void */
+    }
+#endif
+
+    do {
+        last = ngx_thread_pool_done;
+
+    } while (!ngx_atomic_cmp_set(&ngx_thread_pool_done, last, 0));
+
+    /* the stack holds the tasks in reverse order of completion */
+
+    task = NULL;
+
+    for (next = (ngx_thread_task_t *) last; next; /* void */) {
+        last = (ngx_atomic_uint_t) next->next;
+        next->next = task;
+        task = next;
+        next = (ngx_thread_task_t *) last;
+    }
+
+    while (task) {
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                       "run completion handler for task #%ui", task->id);
+
+        event = &task->event;
+        task = task->next;
+
+        event->complete = 1;
+        event->active = 0;
+
+        event->handler(event);
+    }
+}
+
+
+static void *
+ngx_thread_pool_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_thread_pool_conf_t  *tcf;
+
+    tcf = ngx_pcalloc(cycle->pool, sizeof(ngx_thread_pool_conf_t));
+    if (tcf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&tcf->pools, cycle->pool, 4,
+                       sizeof(ngx_thread_pool_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return tcf;
+}
+
+
+static char *
+ngx_thread_pool_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_thread_pool_conf_t *tcf = conf;
+
+    ngx_uint_t           i;
+    ngx_thread_pool_t  **tpp;
+
+    tpp = tcf->pools.elts;
+
+    for (i = 0; i < tcf->pools.nelts; i++) {
+
+        if (tpp[i]->threads) {
+            continue;
+        }
+
+        if (tpp[i]->name.len == ngx_thread_pool_default.len
+            && ngx_strncmp(tpp[i]->name.data, ngx_thread_pool_default.data,
+                           ngx_thread_pool_default.len)
+               == 0)
+        {
+            tpp[i]->threads = 32;
+            tpp[i]->max_queue = 65536;
+            continue;
+        }
+
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "unknown thread pool \"%V\" in %s:%ui",
+                      &tpp[i]->name, tpp[i]->file, tpp[i]->line);
+
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_str_t          *value;
+    ngx_uint_t          i;
+    ngx_thread_pool_t  *tp;
+
+    value = cf->args->elts;
+
+    tp = ngx_thread_pool_add(cf, &value[1]);
+
+    if (tp == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (tp->threads) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate thread pool \"%V\"", &tp->name);
+        return NGX_CONF_ERROR;
+    }
+
+    tp->max_queue = 65536;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "threads=", 8) == 0) {
+
+            tp->threads = ngx_atoi(value[i].data + 8, value[i].len - 8);
+
+            if (tp->threads == (ngx_uint_t) NGX_ERROR || tp->threads == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid threads value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_queue=", 10) == 0) {
+
+            tp->max_queue = ngx_atoi(value[i].data + 10, value[i].len - 10);
+
+            if (tp->max_queue == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid max_queue value \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (tp->threads == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"threads\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+ngx_thread_pool_t *
+ngx_thread_pool_add(ngx_conf_t *cf, ngx_str_t *name)
+{
+    ngx_thread_pool_t       *tp, **tpp;
+    ngx_thread_pool_conf_t  *tcf;
+
+    if (name == NULL) {
+        name = &ngx_thread_pool_default;
+    }
+
+    tp = ngx_thread_pool_get(cf->cycle, name);
+
+    if (tp) {
+        return tp;
+    }
+
+    tp = ngx_pcalloc(cf->pool, sizeof(ngx_thread_pool_t));
+    if (tp == NULL) {
+        return NULL;
+    }
+
+    tp->name = *name;
+    tp->file = cf->conf_file->file.name.data;
+    tp->line = cf->conf_file->line;
+
+    tcf = (ngx_thread_pool_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                                  ngx_thread_pool_module);
+
+    tpp = ngx_array_push(&tcf->pools);
+    if (tpp == NULL) {
+        return NULL;
+    }
+
+    *tpp = tp;
+
+    return tp;
+}
+
+
+ngx_thread_pool_t *
+ngx_thread_pool_get(ngx_cycle_t *cycle, ngx_str_t *name)
+{
+    ngx_uint_t                i;
+    ngx_thread_pool_t       **tpp;
+    ngx_thread_pool_conf_t   *tcf;
+
+    tcf = (ngx_thread_pool_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                                  ngx_thread_pool_module);
+
+    tpp = tcf->pools.elts;
+
+    for (i = 0; i < tcf->pools.nelts; i++) {
+
+        if (tpp[i]->name.len == name->len
+            && ngx_strncmp(tpp[i]->name.data, name->data, name->len) == 0)
+        {
+            return tpp[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_thread_pool_init_worker(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                i;
+    ngx_thread_pool_t       **tpp;
+    ngx_thread_pool_conf_t   *tcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    tcf = (ngx_thread_pool_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                                  ngx_thread_pool_module);
+
+    if (tcf == NULL || tcf->pools.nelts == 0) {
+        return NGX_OK;
+    }
+
+    ngx_thread_pool_done = 0;
+
+#if (NGX_HAVE_SYS_EVENTFD_H)
+
+    ngx_thread_pool_notify[0] = eventfd(0, 0);
+
+    if (ngx_thread_pool_notify[0] == -1) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "eventfd() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_thread_pool_notify[1] = ngx_thread_pool_notify[0];
+
+#else
+
+    if (pipe(ngx_thread_pool_notify) == -1) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno, "pipe() failed");
+        return NGX_ERROR;
+    }
+
+#endif
+
+    for (i = 0; i < 2; i++) {
+        if (ngx_nonblocking(ngx_thread_pool_notify[i]) == -1) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_socket_errno,
+                          ngx_nonblocking_n " thread pool notify failed");
+            return NGX_ERROR;
+        }
+    }
+
+    if (ngx_add_channel_event(cycle, ngx_thread_pool_notify[0],
+                              NGX_READ_EVENT, ngx_thread_pool_handler)
+        == NGX_ERROR)
+    {
+        return NGX_ERROR;
+    }
+
+    tpp = tcf->pools.elts;
+
+    for (i = 0; i < tcf->pools.nelts; i++) {
+        if (ngx_thread_pool_init(tpp[i], cycle->log, cycle->pool) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_thread_pool_exit_worker(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                i;
+    ngx_thread_pool_t       **tpp;
+    ngx_thread_pool_conf_t   *tcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return;
+    }
+
+    tcf = (ngx_thread_pool_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                                  ngx_thread_pool_module);
+
+    if (tcf == NULL) {
+        return;
+    }
+
+    tpp = tcf->pools.elts;
+
+    for (i = 0; i < tcf->pools.nelts; i++) {
+        ngx_thread_pool_destroy(tpp[i]);
+    }
+}
@@ -0,0 +1,873 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * The module uses io_uring as a readiness notification mechanism: every
+ * connection has at most one multishot IORING_OP_POLL_ADD request armed,
+ * so the sockets are read and written by the usual ngx_io functions,
+ * just as with epoll.  The requests to add, modify, and delete events
+ * are only queued in the submission ring, and all of them are submitted
+ * by the same io_uring_enter() that waits for the completions.
+ *
+ * As with epoll, the events added with NGX_CLEAR_EVENT use multishot
+ * requests, that are edge-triggered, and the rest use oneshot requests
+ * that are armed again after each completion to get level-triggered
+ * notifications, e.g. for listening sockets.
+ *
+ * The connection read event index holds the poll mask of the armed
+ * request or NGX_INVALID_INDEX if no request is armed.  The write event
+ * index holds the request generation that is stored in the high bits
+ * of the request user data along with the connection pointer and
+ * the instance bit: the requests being replaced or deleted may post
+ * completions which are not consumed yet.
+ */
+
+
+#if (NGX_PTR_SIZE == 4)
+#define NGX_IOURING_GEN_SHIFT  32
+#else
+#define NGX_IOURING_GEN_SHIFT  48
+#endif
+
+#define NGX_IOURING_GEN_MASK   0xffff
+
+#define NGX_IOURING_ONESHOT    0x40000000
+
+
+#define ngx_iouring_data(c, instance, gen)                                    \
+    ((uint64_t) ((gen) & NGX_IOURING_GEN_MASK) << NGX_IOURING_GEN_SHIFT       \
+     | (uintptr_t) (c) | (instance))
+
+#define ngx_iouring_armed(c)                                                  \
+    ((c)->read->index != NGX_INVALID_INDEX)
+
+
+typedef struct {
+    ngx_uint_t             entries;
+} ngx_iouring_conf_t;
+
+
+typedef struct {
+    void                  *sq_ring;
+    size_t                 sq_ring_size;
+    void                  *cq_ring;
+    size_t                 cq_ring_size;
+
+    uint32_t              *sq_head;
+    uint32_t              *sq_tail;
+    uint32_t               sq_mask;
+    uint32_t               sq_entries;
+    uint32_t              *sq_array;
+    struct io_uring_sqe   *sqes;
+
+    uint32_t              *cq_head;
+    uint32_t              *cq_tail;
+    uint32_t               cq_mask;
+    struct io_uring_cqe   *cqes;
+} ngx_iouring_t;
+
+
+static ngx_int_t ngx_iouring_init(ngx_cycle_t *cycle, ngx_msec_t timer);
+static ngx_int_t ngx_iouring_setup(ngx_cycle_t *cycle,
+    ngx_iouring_conf_t *iucf);
+static void ngx_iouring_done(ngx_cycle_t *cycle);
+static ngx_int_t ngx_iouring_add_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_iouring_del_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_iouring_add_connection(ngx_connection_t *c);
+static ngx_int_t ngx_iouring_del_connection(ngx_connection_t *c,
+    ngx_uint_t flags);
+static ngx_int_t ngx_iouring_poll(ngx_connection_t *c, uint32_t events);
+static ngx_int_t ngx_iouring_arm(ngx_connection_t *c, uint32_t events);
+static struct io_uring_sqe *ngx_iouring_get_sqe(ngx_log_t *log);
+static ngx_int_t ngx_iouring_submit(ngx_log_t *log);
+static ngx_int_t ngx_iouring_process_events(ngx_cycle_t *cycle,
+    ngx_msec_t timer, ngx_uint_t flags);
+
+static void *ngx_iouring_create_conf(ngx_cycle_t *cycle);
+static char *ngx_iouring_init_conf(ngx_cycle_t *cycle, void *conf);
+
+static int            ring = -1;
+static ngx_iouring_t  ngx_iouring;
+
+static ngx_str_t      iouring_name = ngx_string("io_uring");
+
+static ngx_command_t  ngx_iouring_commands[] = {
+
+    { ngx_string("io_uring_entries"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_iouring_conf_t, entries),
+      NULL },
+
+      ngx_null_command
+};
+
+
+ngx_event_module_t  ngx_iouring_module_ctx = {
+    &iouring_name,
+    ngx_iouring_create_conf,             /* create configuration */
+    ngx_iouring_init_conf,               /* init configuration */
+
+    {
+        ngx_iouring_add_event,           /* add an event */
+        ngx_iouring_del_event,           /* delete an event */
+        ngx_iouring_add_event,           /* enable an event */
+        ngx_iouring_del_event,           /* disable an event */
+        ngx_iouring_add_connection,      /* add an connection */
+        ngx_iouring_del_connection,      /* delete an connection */
+        NULL,                            /* process the changes */
+        ngx_iouring_process_events,      /* process the events */
+        ngx_iouring_init,                /* init the events */
+        ngx_iouring_done,                /* done the events */
+    }
+};
+
+ngx_module_t  ngx_iouring_module = {
+    NGX_MODULE_V1,
+    &ngx_iouring_module_ctx,             /* module context */
+    ngx_iouring_commands,                /* module directives */
+    NGX_EVENT_MODULE,                    /* module type */
+    NULL,                                /* init master */
+    NULL,                                /* init module */
+    NULL,                                /* init process */
+    NULL,                                /* init thread */
+    NULL,                                /* exit thread */
+    NULL,                                /* exit process */
+    NULL,                                /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+/*
+ * We call io_uring_setup() and io_uring_enter() directly as syscalls
+ * instead of liburing usage to avoid an external dependency.
+ */
+
+static int
+io_uring_setup(u_int entries, struct io_uring_params *p)
+{
+    return syscall(SYS_io_uring_setup, entries, p);
+}
+
+
+static int
+io_uring_enter(int fd, u_int to_submit, u_int min_complete, u_int flags,
+    void *arg, size_t size)
+{
+    return syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags,
+                   arg, size);
+}
+
+
+static ngx_int_t
+ngx_iouring_init(ngx_cycle_t *cycle, ngx_msec_t timer)
+{
+    ngx_iouring_conf_t  *iucf;
+
+    iucf = ngx_event_get_conf(cycle->conf_ctx, ngx_iouring_module);
+
+    if (ring == -1) {
+        if (ngx_iouring_setup(cycle, iucf) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+#if (NGX_HAVE_FILE_AIO)
+
+    /* file AIO completions are reported through the epoll eventfd only */
+
+    ngx_file_aio = 0;
+
+#endif
+
+    ngx_io = ngx_os_io;
+
+    ngx_event_actions = ngx_iouring_module_ctx.actions;
+
+    ngx_event_flags = NGX_USE_CLEAR_EVENT
+                      |NGX_USE_GREEDY_EVENT
+                      |NGX_USE_EPOLL_EVENT;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_setup(ngx_cycle_t *cycle, ngx_iouring_conf_t *iucf)
+{
+    u_char                  *sq, *cq;
+    struct io_uring_params   p;
+
+    ngx_memzero(&p, sizeof(struct io_uring_params));
+
+    /*
+     * the completion ring is sized to have room for events
+     * of all connections
+     */
+
+    p.flags = IORING_SETUP_CQSIZE|IORING_SETUP_CLAMP;
+    p.cq_entries = ngx_max(cycle->connection_n, 2 * iucf->entries);
+
+    ring = io_uring_setup(iucf->entries, &p);
+
+    if (ring == -1) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "io_uring_setup() failed");
+        return NGX_ERROR;
+    }
+
+    /* IORING_FEAT_RSRC_TAGS appeared in Linux 5.13 with multishot polls */
+
+    if ((p.features & (IORING_FEAT_NODROP|IORING_FEAT_EXT_ARG
+                       |IORING_FEAT_RSRC_TAGS))
+        != (IORING_FEAT_NODROP|IORING_FEAT_EXT_ARG|IORING_FEAT_RSRC_TAGS))
+    {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "io_uring features %08XD are not sufficient, "
+                      "Linux 5.13 or newer is required", p.features);
+        goto failed;
+    }
+
+    ngx_iouring.sq_ring_size = p.sq_off.array
+                               + p.sq_entries * sizeof(uint32_t);
+    ngx_iouring.cq_ring_size = p.cq_off.cqes
+                               + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ngx_iouring.sq_ring_size = ngx_max(ngx_iouring.sq_ring_size,
+                                           ngx_iouring.cq_ring_size);
+    }
+
+    ngx_iouring.sq_ring = mmap(NULL, ngx_iouring.sq_ring_size,
+                               PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                               ring, IORING_OFF_SQ_RING);
+
+    if (ngx_iouring.sq_ring == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQ_RING) failed");
+        ngx_iouring.sq_ring = NULL;
+        goto failed;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ngx_iouring.cq_ring = ngx_iouring.sq_ring;
+        ngx_iouring.cq_ring_size = 0;
+
+    } else {
+        ngx_iouring.cq_ring = mmap(NULL, ngx_iouring.cq_ring_size,
+                                   PROT_READ|PROT_WRITE,
+                                   MAP_SHARED|MAP_POPULATE,
+                                   ring, IORING_OFF_CQ_RING);
+
+        if (ngx_iouring.cq_ring == MAP_FAILED) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                          "mmap(IORING_OFF_CQ_RING) failed");
+            ngx_iouring.cq_ring = NULL;
+            goto failed;
+        }
+    }
+
+    ngx_iouring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                            PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                            ring, IORING_OFF_SQES);
+
+    if (ngx_iouring.sqes == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQES) failed");
+        ngx_iouring.sqes = NULL;
+        goto failed;
+    }
+
+    sq = ngx_iouring.sq_ring;
+
+    ngx_iouring.sq_head = (uint32_t *) (sq + p.sq_off.head);
+    ngx_iouring.sq_tail = (uint32_t *) (sq + p.sq_off.tail);
+    ngx_iouring.sq_mask = *(uint32_t *) (sq + p.sq_off.ring_mask);
+    ngx_iouring.sq_entries = p.sq_entries;
+    ngx_iouring.sq_array = (uint32_t *) (sq + p.sq_off.array);
+
+    cq = ngx_iouring.cq_ring;
+
+    ngx_iouring.cq_head = (uint32_t *) (cq + p.cq_off.head);
+    ngx_iouring.cq_tail = (uint32_t *) (cq + p.cq_off.tail);
+    ngx_iouring.cq_mask = *(uint32_t *) (cq + p.cq_off.ring_mask);
+    ngx_iouring.cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring: fd:%d sq:%uD cq:%uD",
+                   ring, p.sq_entries, p.cq_entries);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_iouring_done(cycle);
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_iouring_done(ngx_cycle_t *cycle)
+{
+    if (ngx_iouring.sqes) {
+        if (munmap(ngx_iouring.sqes,
+                   ngx_iouring.sq_entries * sizeof(struct io_uring_sqe))
+            == -1)
+        {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "munmap(IORING_OFF_SQES) failed");
+        }
+    }
+
+    if (ngx_iouring.cq_ring && ngx_iouring.cq_ring_size) {
+        if (munmap(ngx_iouring.cq_ring, ngx_iouring.cq_ring_size) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "munmap(IORING_OFF_CQ_RING) failed");
+        }
+    }
+
+    if (ngx_iouring.sq_ring) {
+        if (munmap(ngx_iouring.sq_ring, ngx_iouring.sq_ring_size) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "munmap(IORING_OFF_SQ_RING) failed");
+        }
+    }
+
+    if (ring != -1 && close(ring) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ring = -1;
+
+    ngx_memzero(&ngx_iouring, sizeof(ngx_iouring_t));
+}
+
+
+static ngx_int_t
+ngx_iouring_add_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    uint32_t           events;
+    ngx_event_t       *e;
+    ngx_connection_t  *c;
+
+    c = ev->data;
+
+    if (event == NGX_READ_EVENT) {
+        e = c->write;
+        events = POLLIN|POLLRDHUP;
+
+        if (e->active) {
+            events |= POLLOUT;
+        }
+
+    } else {
+        e = c->read;
+        events = POLLOUT;
+
+        if (e->active) {
+            events |= POLLIN|POLLRDHUP;
+        }
+    }
+
+    if (!(flags & NGX_CLEAR_EVENT)) {
+        events |= NGX_IOURING_ONESHOT;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring add event: fd:%d ev:%08XD", c->fd, events);
+
+    if (ngx_iouring_poll(c, events) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ev->active = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_del_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    uint32_t           events;
+    ngx_event_t       *e;
+    ngx_connection_t  *c;
+
+    /*
+     * an armed poll request holds a reference to the file, so unlike
+     * with epoll the request has to be deleted even if the file descriptor
+     * is going to be closed
+     */
+
+    c = ev->data;
+
+    if (event == NGX_READ_EVENT) {
+        e = c->write;
+        events = POLLOUT;
+
+    } else {
+        e = c->read;
+        events = POLLIN|POLLRDHUP;
+    }
+
+    if (!e->active || (flags & NGX_CLOSE_EVENT)) {
+        events = 0;
+
+    } else if (!(flags & NGX_CLEAR_EVENT)) {
+        events |= NGX_IOURING_ONESHOT;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring del event: fd:%d ev:%08XD", c->fd, events);
+
+    if (ngx_iouring_poll(c, events) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ev->active = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_add_connection(ngx_connection_t *c)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring add connection: fd:%d", c->fd);
+
+    if (ngx_iouring_poll(c, POLLIN|POLLOUT|POLLRDHUP) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    c->read->active = 1;
+    c->write->active = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_del_connection(ngx_connection_t *c, ngx_uint_t flags)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring del connection: fd:%d", c->fd);
+
+    if (ngx_iouring_poll(c, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    c->read->active = 0;
+    c->write->active = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_poll(ngx_connection_t *c, uint32_t events)
+{
+    struct io_uring_sqe  *sqe;
+
+    if (ngx_iouring_armed(c)) {
+
+        if (c->read->index == events) {
+            return NGX_OK;
+        }
+
+        sqe = ngx_iouring_get_sqe(c->log);
+        if (sqe == NULL) {
+            return NGX_ERROR;
+        }
+
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = ngx_iouring_data(c, c->read->instance, c->write->index);
+
+        /* completions of the removed request will be stale */
+
+        c->read->index = NGX_INVALID_INDEX;
+        c->write->index++;
+    }
+
+    if (events == 0) {
+        return NGX_OK;
+    }
+
+    return ngx_iouring_arm(c, events);
+}
+
+
+static ngx_int_t
+ngx_iouring_arm(ngx_connection_t *c, uint32_t events)
+{
+    uint32_t              mask;
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe(c->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    mask = events & ~NGX_IOURING_ONESHOT;
+
+#if !(NGX_HAVE_LITTLE_ENDIAN)
+    mask = (mask << 16) | (mask >> 16);
+#endif
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = c->fd;
+    sqe->len = (events & NGX_IOURING_ONESHOT) ? 0 : IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = mask;
+    sqe->user_data = ngx_iouring_data(c, c->read->instance, c->write->index);
+
+    c->read->index = events;
+
+    return NGX_OK;
+}
+
+
+static struct io_uring_sqe *
+ngx_iouring_get_sqe(ngx_log_t *log)
+{
+    uint32_t              tail, n;
+    struct io_uring_sqe  *sqe;
+
+    tail = *ngx_iouring.sq_tail;
+
+    if (tail - *ngx_iouring.sq_head >= ngx_iouring.sq_entries) {
+
+        /* the submission ring is full */
+
+        if (ngx_iouring_submit(log) != NGX_OK) {
+            return NULL;
+        }
+
+        if (tail - *ngx_iouring.sq_head >= ngx_iouring.sq_entries) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "io_uring submission queue is full");
+            return NULL;
+        }
+    }
+
+    n = tail & ngx_iouring.sq_mask;
+
+    sqe = &ngx_iouring.sqes[n];
+    ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+    ngx_iouring.sq_array[n] = n;
+
+    ngx_memory_barrier();
+
+    *ngx_iouring.sq_tail = tail + 1;
+
+    return sqe;
+}
+
+
+static ngx_int_t
+ngx_iouring_submit(ngx_log_t *log)
+{
+    int        n;
+    uint32_t   pending;
+    ngx_err_t  err;
+
+    pending = *ngx_iouring.sq_tail - *ngx_iouring.sq_head;
+
+    n = io_uring_enter(ring, pending, 0, 0, NULL, 0);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring submit: %uD of %uD", (uint32_t) n, pending);
+
+    if (n == -1) {
+        err = ngx_errno;
+
+        if (err == NGX_EAGAIN || err == NGX_EBUSY || err == NGX_EINTR) {
+            return NGX_OK;
+        }
+
+        ngx_log_error(NGX_LOG_ALERT, log, err, "io_uring_enter() failed");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
+    ngx_uint_t flags)
+{
+    int                            n;
+    int32_t                        res;
+    uint32_t                       head, tail, pending, revents, cflags;
+    uint64_t                       data;
+    ngx_int_t                      instance;
+    ngx_uint_t                     level, gen;
+    ngx_err_t                      err;
+    ngx_event_t                   *rev, *wev, **queue;
+    ngx_connection_t              *c;
+    struct io_uring_cqe           *cqe;
+    struct __kernel_timespec       ts;
+    struct io_uring_getevents_arg  arg;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring timer: %M", timer);
+
+    ngx_memzero(&arg, sizeof(struct io_uring_getevents_arg));
+
+    if (timer != NGX_TIMER_INFINITE) {
+        ts.tv_sec = timer / 1000;
+        ts.tv_nsec = (timer % 1000) * 1000000;
+        arg.ts = (uint64_t) (uintptr_t) &ts;
+    }
+
+    pending = *ngx_iouring.sq_tail - *ngx_iouring.sq_head;
+
+    /* submit the queued changes and wait for the events in one syscall */
+
+    n = io_uring_enter(ring, pending, 1,
+                       IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG,
+                       &arg, sizeof(struct io_uring_getevents_arg));
+
+    err = (n == -1) ? ngx_errno : 0;
+
+    if (flags & NGX_UPDATE_TIME || ngx_event_timer_alarm) {
+        ngx_time_update();
+    }
+
+    if (err) {
+        if (err == NGX_EINTR) {
+
+            if (ngx_event_timer_alarm) {
+                ngx_event_timer_alarm = 0;
+                return NGX_OK;
+            }
+
+            level = NGX_LOG_INFO;
+
+        } else if (err == ETIME || err == NGX_EBUSY) {
+
+            /*
+             * ETIME is the timeout, and EBUSY is returned while the kernel
+             * is not able to flush overflown completions: the completion
+             * ring has to be consumed first
+             */
+
+            level = 0;
+
+        } else {
+            level = NGX_LOG_ALERT;
+        }
+
+        if (level) {
+            ngx_log_error(level, cycle->log, err, "io_uring_enter() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    head = *ngx_iouring.cq_head;
+    tail = *ngx_iouring.cq_tail;
+
+    ngx_memory_barrier();
+
+    if (head == tail) {
+        if (timer != NGX_TIMER_INFINITE || err == NGX_EBUSY) {
+            return NGX_OK;
+        }
+
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                      "io_uring_enter() returned no events without timeout");
+        return NGX_ERROR;
+    }
+
+    ngx_mutex_lock(ngx_posted_events_mutex);
+
+    for ( /* void */ ; head != tail; head++) {
+        cqe = &ngx_iouring.cqes[head & ngx_iouring.cq_mask];
+
+        data = cqe->user_data;
+        res = cqe->res;
+        cflags = cqe->flags;
+
+        if (data == 0) {
+
+            /* the poll remove request */
+
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring: poll remove: %d", res);
+            continue;
+        }
+
+        gen = (ngx_uint_t) (data >> NGX_IOURING_GEN_SHIFT);
+
+        c = (ngx_connection_t *) (uintptr_t)
+                (data & (((uint64_t) 1 << NGX_IOURING_GEN_SHIFT) - 1));
+
+        instance = (uintptr_t) c & 1;
+        c = (ngx_connection_t *) ((uintptr_t) c & (uintptr_t) ~1);
+
+        rev = c->read;
+        wev = c->write;
+
+        if (c->fd == -1
+            || rev->instance != instance
+            || gen != (wev->index & NGX_IOURING_GEN_MASK))
+        {
+            /*
+             * the stale event from a poll request that was deleted,
+             * or from a file descriptor that was just closed
+             */
+
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring: stale event %p", c);
+            continue;
+        }
+
+        ngx_log_debug4(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: fd:%d ev:%04XD fl:%uD d:%xL",
+                       c->fd, res, cflags, data);
+
+        if (res < 0) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, -res,
+                          "io_uring poll on fd:%d failed", c->fd);
+
+            revents = POLLERR;
+
+        } else {
+            revents = (uint32_t) res;
+        }
+
+        if (!(cflags & IORING_CQE_F_MORE)) {
+
+            /*
+             * the oneshot request has been completed, or the multishot
+             * request has been terminated by the kernel: the request
+             * is armed again to be submitted after the events are handled
+             */
+
+            wev->index = gen + 1;
+
+            if (res < 0) {
+                rev->index = NGX_INVALID_INDEX;
+
+            } else if (ngx_iouring_arm(c, (uint32_t) rev->index) != NGX_OK) {
+                rev->index = NGX_INVALID_INDEX;
+                revents = POLLERR;
+            }
+        }
+
+        if ((revents & (POLLERR|POLLHUP))
+             && (revents & (POLLIN|POLLOUT)) == 0)
+        {
+            /*
+             * if the error events were returned without POLLIN or POLLOUT,
+             * then add these flags to handle the events at least in one
+             * active handler
+             */
+
+            revents |= POLLIN|POLLOUT;
+        }
+
+        if ((revents & POLLIN) && rev->active) {
+
+            if (revents & POLLRDHUP) {
+                rev->pending_eof = 1;
+            }
+
+            if ((flags & NGX_POST_THREAD_EVENTS) && !rev->accept) {
+                rev->posted_ready = 1;
+
+            } else {
+                rev->ready = 1;
+            }
+
+            if (flags & NGX_POST_EVENTS) {
+                queue = (ngx_event_t **) (rev->accept ?
+                               &ngx_posted_accept_events : &ngx_posted_events);
+
+                ngx_locked_post_event(rev, queue);
+
+            } else {
+                rev->handler(rev);
+            }
+        }
+
+        if ((revents & POLLOUT) && wev->active) {
+
+            if (c->fd == -1 || wev->instance != instance) {
+
+                /*
+                 * the stale event from a file descriptor
+                 * that was just closed in this iteration
+                 */
+
+                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                               "io_uring: stale event %p", c);
+                continue;
+            }
+
+            if (flags & NGX_POST_THREAD_EVENTS) {
+                wev->posted_ready = 1;
+
+            } else {
+                wev->ready = 1;
+            }
+
+            if (flags & NGX_POST_EVENTS) {
+                ngx_locked_post_event(wev, &ngx_posted_events);
+
+            } else {
+                wev->handler(wev);
+            }
+        }
+    }
+
+    ngx_memory_barrier();
+
+    *ngx_iouring.cq_head = tail;
+
+    ngx_mutex_unlock(ngx_posted_events_mutex);
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_iouring_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_iouring_conf_t  *iucf;
+
+    iucf = ngx_palloc(cycle->pool, sizeof(ngx_iouring_conf_t));
+    if (iucf == NULL) {
+        return NULL;
+    }
+
+    iucf->entries = NGX_CONF_UNSET;
+
+    return iucf;
+}
+
+
+static char *
+ngx_iouring_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_iouring_conf_t *iucf = conf;
+
+    ngx_conf_init_uint_value(iucf->entries, 512);
+
+    return NGX_CONF_OK;
+}
@@ -52,6 +52,7 @@ ngx_atomic_t         *ngx_connection_counter = &connection_counter;
 ngx_atomic_t         *ngx_accept_mutex_ptr;
 ngx_shmtx_t           ngx_accept_mutex;
 ngx_uint_t            ngx_use_accept_mutex;
+ngx_uint_t            ngx_use_exclusive_accept;
 ngx_uint_t            ngx_accept_events;
 ngx_uint_t            ngx_accept_mutex_held;
 ngx_msec_t            ngx_accept_mutex_delay;
@@ -75,6 +76,11 @@ ngx_atomic_t  *ngx_stat_writing = &ngx_stat_writing0;
 ngx_atomic_t   ngx_stat_waiting0;
 ngx_atomic_t  *ngx_stat_waiting = &ngx_stat_waiting0;
 
+#if (NGX_POLARSSL)
+ngx_atomic_t   ngx_stat_ssl0[NGX_SSL_STAT_N];
+ngx_atomic_t  *ngx_stat_ssl = ngx_stat_ssl0;
+#endif
+
 #endif
 
 
@@ -515,6 +521,10 @@ ngx_event_module_init(ngx_cycle_t *cycle)
            + cl          /* ngx_stat_writing */
            + cl;         /* ngx_stat_waiting */
 
+#if (NGX_POLARSSL)
+    size += NGX_SSL_STAT_N * sizeof(ngx_atomic_t);      /* ngx_stat_ssl */
+#endif
+
 #endif
 
     shm.size = size;
@@ -562,6 +572,10 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     ngx_stat_writing = (ngx_atomic_t *) (shared + 8 * cl);
     ngx_stat_waiting = (ngx_atomic_t *) (shared + 9 * cl);
 
+#if (NGX_POLARSSL)
+    ngx_stat_ssl = (ngx_atomic_t *) (shared + 10 * cl);
+#endif
+
 #endif
 
     return NGX_OK;
@@ -586,7 +600,7 @@ ngx_timer_signal_handler(int signo)
 static ngx_int_t
 ngx_event_process_init(ngx_cycle_t *cycle)
 {
-    ngx_uint_t           m, i;
+    ngx_uint_t           m, i, flags;
     ngx_event_t         *rev, *wev;
     ngx_listening_t     *ls;
     ngx_connection_t    *c, *next, *old;
@@ -606,6 +620,28 @@ ngx_event_process_init(ngx_cycle_t *cycle)
         ngx_use_accept_mutex = 0;
     }
 
+#if (NGX_HAVE_REUSEPORT)
+
+    /*
+     * each worker accepts on its own SO_REUSEPORT sockets without the mutex,
+     * so it is needed only if some socket is shared by all workers
+     */
+
+    if (ngx_use_accept_mutex) {
+        ls = cycle->listening.elts;
+        for (i = 0; i < cycle->listening.nelts; i++) {
+            if (!ls[i].reuseport) {
+                break;
+            }
+        }
+
+        if (i == cycle->listening.nelts) {
+            ngx_use_accept_mutex = 0;
+        }
+    }
+
+#endif
+
 #if (NGX_WIN32)
 
     /*
@@ -647,6 +683,25 @@ ngx_event_process_init(ngx_cycle_t *cycle)
         break;
     }
 
+    ngx_use_exclusive_accept = 0;
+
+#if (NGX_HAVE_EPOLLEXCLUSIVE)
+
+    /*
+     * without the accept mutex the workers wait on the shared listening
+     * sockets all together, EPOLLEXCLUSIVE makes the kernel wake up only
+     * one of them for a new connection
+     */
+
+    if (ecf->use == ngx_epoll_module.ctx_index
+        && ccf->master && ccf->worker_processes > 1
+        && !ngx_use_accept_mutex)
+    {
+        ngx_use_exclusive_accept = 1;
+    }
+
+#endif
+
 #if !(NGX_WIN32)
 
     if (ngx_timer_resolution && !(ngx_event_flags & NGX_USE_TIMER_EVENT)) {
@@ -759,6 +814,12 @@ ngx_event_process_init(ngx_cycle_t *cycle)
     ls = cycle->listening.elts;
     for (i = 0; i < cycle->listening.nelts; i++) {
 
+#if (NGX_HAVE_REUSEPORT)
+        if (ls[i].reuseport && ls[i].worker != ngx_worker) {
+            continue;
+        }
+#endif
+
         c = ngx_get_connection(ls[i].fd, cycle->log);
 
         if (c == NULL) {
@@ -839,7 +900,12 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 
         rev->handler = ngx_event_accept;
 
-        if (ngx_use_accept_mutex) {
+        if (ngx_use_accept_mutex
+#if (NGX_HAVE_REUSEPORT)
+            && !ls[i].reuseport
+#endif
+           )
+        {
             continue;
         }
 
@@ -849,7 +915,15 @@ ngx_event_process_init(ngx_cycle_t *cycle)
             }
 
         } else {
-            if (ngx_add_event(rev, NGX_READ_EVENT, 0) == NGX_ERROR) {
+            flags = 0;
+
+#if (NGX_HAVE_EPOLLEXCLUSIVE)
+            if (ngx_use_exclusive_accept) {
+                flags = NGX_EXCLUSIVE_EVENT;
+            }
+#endif
+
+            if (ngx_add_event(rev, NGX_READ_EVENT, flags) == NGX_ERROR) {
                 return NGX_ERROR;
             }
         }
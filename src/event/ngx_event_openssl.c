@@ -251,6 +251,27 @@ ngx_ssl_create(ngx_ssl_t *ssl, ngx_uint_t protocols, void *data)
 }
 
 
+ngx_int_t
+ngx_ssl_certificates(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *certs,
+    ngx_array_t *keys)
+{
+    /*
+     * the certificate is kept in the SSL_CTX ex_data for OCSP stapling
+     * and the variables, and its chain is added to the extra certificates
+     * shared by the SSL_CTX, so only one certificate can be used
+     */
+
+    if (certs->nelts > 1) {
+        ngx_log_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "only one \"ssl_certificate\" is supported "
+                      "with OpenSSL");
+        return NGX_ERROR;
+    }
+
+    return ngx_ssl_certificate(cf, ssl, certs->elts, keys->elts);
+}
+
+
 ngx_int_t
 ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
     ngx_str_t *key)
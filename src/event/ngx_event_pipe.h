@@ -34,6 +34,11 @@ struct ngx_event_pipe_s {
     ngx_chain_t       *free;
     ngx_chain_t       *busy;
 
+#if (NGX_THREAD_POOL)
+    /* the chain being written to the temporary file in a thread */
+    ngx_chain_t       *writing;
+#endif
+
     /*
      * the input filter i.e. that moves HTTP/1.1 chunks
      * from the raw bufs to an incoming chain
@@ -56,6 +61,7 @@ struct ngx_event_pipe_s {
     unsigned           downstream_done:1;
     unsigned           downstream_error:1;
     unsigned           cyclic_temp_file:1;
+    unsigned           aio:1;
 
     ngx_int_t          allocated;
     ngx_bufs_t         bufs;
@@ -82,6 +88,13 @@ struct ngx_event_pipe_s {
 
     ngx_temp_file_t   *temp_file;
 
+#if (NGX_THREAD_POOL)
+    ngx_int_t        (*thread_handler)(ngx_thread_task_t *task,
+                                       ngx_file_t *file);
+    void              *thread_ctx;
+    ngx_thread_task_t *thread_task;
+#endif
+
     /* STUB */ int     num;
 };
 
@@ -10,9 +10,82 @@
 #include <ngx_core.h>
 #include <ngx_event.h>
 
+#if (NGX_THREAD_POOL)
+#include <ngx_thread_pool.h>
+#endif
+
 
 #define POLARSSL_DN_MAX_LENGTH          256
 #define POLARSSL_SSL_CIPHER_MAX_LENGTH  64
+#define POLARSSL_ECP_CURVE_MAX_LENGTH   32
+
+#define NGX_SSL_CLIENT_HELLO_PEEK       2048
+
+#define NGX_SSL_MAX_FREE_BUFFERS        64
+
+#define NGX_SSL_ASYNC                   1
+
+#define NGX_SSL_CACHE_FILE_MAGIC        "NGXSSC01"
+#define NGX_SSL_CACHE_FILE_HEADER       (8 + 12 + 16)
+#define NGX_SSL_CACHE_FILE_RECORD       (8 + 2 + 1 + 1 + 32 + 48)
+
+
+typedef struct {
+    ngx_shm_zone_t             *shm_zone;
+    ngx_str_t                   file;
+    u_char                      key[32];
+} ngx_ssl_cache_file_t;
+
+
+typedef struct {
+    ngx_array_t                 cache_files;    /* ngx_ssl_cache_file_t */
+} ngx_polarssl_conf_t;
+
+
+/*
+ * The revoked serial numbers of a CRL in an open addressing hash table.
+ * A CRL signed by one of the CA certificates is trusted beforehand, one
+ * signed by an intermediate is checked against the issuer found in the
+ * chain sent by the client, and the issuer is remembered for the next
+ * handshakes.
+ */
+
+typedef struct {
+    x509_crl                   *crl;
+    x509_crl_entry            **entries;
+    ngx_uint_t                  mask;
+
+    const md_info_t            *md_info;
+    u_char                      hash[POLARSSL_MD_MAX_SIZE];
+
+    u_char                     *issuer;
+    size_t                      issuer_len;
+
+    ngx_uint_t                  trusted;    /* unsigned  trusted:1; */
+} ngx_ssl_crl_index_t;
+
+
+#if (NGX_THREAD_POOL)
+
+/*
+ * A connection whose private key operations are done in a thread pool
+ * keeps its PolarSSL context here rather than in the connection pool,
+ * as a running task may outlive the connection.
+ */
+
+struct ngx_ssl_async_s {
+    ngx_ssl_conn_t              ssl_conn;
+    ngx_thread_task_t           task;
+    ngx_thread_pool_t          *thread_pool;
+    ngx_connection_t           *connection;
+    ctr_drbg_context            ctr_drbg;
+    int                         sslerr;
+    ngx_uint_t                  time;
+    unsigned                    running:1;
+    unsigned                    done:1;
+};
+
+#endif
 
 
 static void ngx_ssl_handshake_handler(ngx_event_t *ev);
@@ -20,8 +93,16 @@ static ngx_int_t ngx_ssl_handle_recv(ngx_connection_t *c, int n);
 static void ngx_ssl_write_handler(ngx_event_t *wev);
 static void ngx_ssl_read_handler(ngx_event_t *rev);
 static void ngx_ssl_shutdown_handler(ngx_event_t *ev);
-static void ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
-    ngx_slab_pool_t *shpool, ngx_uint_t n);
+static void ngx_ssl_session_cache_unlock(ngx_shm_zone_t *shm_zone,
+    ngx_pid_t pid);
+static ngx_ssl_session_shard_t *ngx_ssl_session_shard_init(
+    ngx_slab_pool_t *shpool);
+static ngx_int_t ngx_ssl_session_insert(ngx_ssl_session_shard_t *shard,
+    ngx_ssl_sess_id_t *sess);
+static ngx_ssl_sess_id_t *ngx_ssl_session_lookup(
+    ngx_ssl_session_shard_t *shard, uint32_t hash, u_char *id, size_t len);
+static void ngx_ssl_expire_sessions(ngx_ssl_session_shard_t *shard,
+    ngx_uint_t n);
 static void ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 static int ngx_polarssl_get_cache(void *ctx, ssl_session *session);
@@ -32,14 +113,86 @@ static int ngx_polarssl_cipher_in_list(const int id, const int *ciphersuites);
 static ngx_int_t ngx_polarssl_set_cipher_list(ngx_ssl_t *ssl,
     const char *ciphers);
 static const char *ngx_polarssl_verify_error_str(int n);
-static int ngx_polarssl_rng(void *data, unsigned char *output, size_t output_len);
-static void ngx_polarssl_exit(ngx_cycle_t *cycle);
+static int ngx_polarssl_handshake(ngx_connection_t *c);
+static void ngx_polarssl_free(ngx_ssl_conn_t *ssl_conn);
+static void ngx_polarssl_release_buffers(ngx_connection_t *c);
+static ngx_int_t ngx_polarssl_restore_buffers(ngx_connection_t *c);
+static int ngx_polarssl_handshake_step(ngx_connection_t *c);
+static int ngx_polarssl_fetch_record(ngx_ssl_conn_t *ssl_conn, size_t *len);
+static ngx_int_t ngx_polarssl_crl_index(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    x509_crl *crl);
+static int ngx_polarssl_verify_crl(void *data, x509_crt *crt, int depth,
+    int *flags);
+static ngx_int_t ngx_polarssl_verify_crl_issuer(ngx_ssl_t *ssl,
+    ngx_ssl_crl_index_t *index, x509_crt *crt);
+static int ngx_polarssl_verify_step(ngx_connection_t *c);
+static ngx_int_t ngx_polarssl_verify_lookup(ngx_connection_t *c, u_char *hash,
+    int *result);
+static void ngx_polarssl_verify_insert(ngx_connection_t *c);
+static void ngx_ssl_expire_verified(ngx_ssl_verify_cache_t *cache,
+    ngx_uint_t n);
+static void ngx_ssl_verify_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_uint_t ngx_polarssl_usec(void);
+#if (NGX_STAT_STUB)
+static void ngx_polarssl_handshake_stat(ngx_connection_t *c, int sslerr);
+#endif
+static ngx_chain_t *ngx_polarssl_send_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+static int ngx_polarssl_bio_recv(void *ctx, unsigned char *buf, size_t len);
+static int ngx_polarssl_bio_send(void *ctx, const unsigned char *buf,
+    size_t len);
+static int ngx_polarssl_bio_flush(ngx_connection_t *c);
+#if (NGX_HAVE_KTLS)
+static void ngx_polarssl_ktls(ngx_connection_t *c);
+static int ngx_polarssl_ktls_send(void *ctx, const unsigned char *buf,
+    size_t len);
+#endif
+#if (NGX_THREAD_POOL)
+static ngx_ssl_async_t *ngx_polarssl_async_create(ngx_connection_t *c,
+    ngx_thread_pool_t *tp);
+static int ngx_polarssl_async_handshake(ngx_connection_t *c);
+static int ngx_polarssl_async_prepare(ngx_ssl_conn_t *ssl_conn);
+static ngx_int_t ngx_polarssl_async_post(ngx_connection_t *c);
+static void ngx_polarssl_async_restore(ngx_ssl_async_t *async,
+    ngx_connection_t *c);
+static void ngx_polarssl_async_handler(void *data, ngx_log_t *log);
+static void ngx_polarssl_async_done(ngx_event_t *ev);
+static void ngx_polarssl_async_cleanup(void *data);
+static int ngx_polarssl_async_recv(void *ctx, unsigned char *buf, size_t len);
+static int ngx_polarssl_async_send(void *ctx, const unsigned char *buf,
+    size_t len);
+#endif
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+static void ngx_ssl_session_ticket_key_init(ngx_ssl_session_ticket_key_t *key,
+    u_char *buf);
+static ngx_ssl_session_ticket_key_t *ngx_ssl_session_ticket_key_lookup(
+    ngx_connection_t *c, ngx_array_t *keys);
+#endif
+static ngx_int_t ngx_polarssl_session_cache_load(ngx_cycle_t *cycle,
+    ngx_ssl_cache_file_t *cfe);
+static ngx_int_t ngx_polarssl_session_cache_save(ngx_cycle_t *cycle,
+    ngx_ssl_cache_file_t *cfe);
+static int ngx_libc_cdecl ngx_polarssl_session_cmp(const void *one,
+    const void *two);
+static void *ngx_polarssl_create_conf(ngx_cycle_t *cycle);
+static ngx_int_t ngx_polarssl_init_module(ngx_cycle_t *cycle);
+static ngx_int_t ngx_polarssl_init_process(ngx_cycle_t *cycle);
+static void ngx_polarssl_exit_master(ngx_cycle_t *cycle);
 
 
+/*
+ * The DRBG is seeded in the master process and reseeded by each worker
+ * after fork(), so workers neither share the random stream nor need
+ * a lock around it.
+ */
+
+static entropy_context  ngx_entropy;
 static ctr_drbg_context ngx_ctr_drbg;
-#if (NGX_THREADS)
-static ngx_mutex *ngx_ctr_drbg_mutex;
-#endif
+
+/* record buffers of idle connections kept for reuse by the worker */
+static u_char          *ngx_polarssl_free_buffers;
+static ngx_uint_t       ngx_polarssl_nfree_buffers;
 
 
 static ngx_command_t  ngx_polarssl_commands[] = {
@@ -49,7 +202,7 @@ static ngx_command_t  ngx_polarssl_commands[] = {
 
 static ngx_core_module_t  ngx_polarssl_module_ctx = {
     ngx_string("polarssl"),
-    NULL,
+    ngx_polarssl_create_conf,
     NULL
 };
 
@@ -60,12 +213,12 @@ ngx_module_t  ngx_polarssl_module = {
     ngx_polarssl_commands,              /* module directives */
     NGX_CORE_MODULE,                    /* module type */
     NULL,                               /* init master */
-    NULL,                               /* init module */
-    NULL,                               /* init process */
+    ngx_polarssl_init_module,           /* init module */
+    ngx_polarssl_init_process,          /* init process */
     NULL,                               /* init thread */
     NULL,                               /* exit thread */
     NULL,                               /* exit process */
-    ngx_polarssl_exit,                  /* exit master */
+    ngx_polarssl_exit_master,           /* exit master */
     NGX_MODULE_V1_PADDING
 };
 
@@ -74,13 +227,15 @@ ngx_int_t
 ngx_ssl_init(ngx_log_t *log)
 {
     static unsigned char  ctr_drbg_custom[] = "nginx-polarssl";
-    entropy_context       entropy;
     int                   sslerr;
 
-    /* Initialize the PRNG */
+    /*
+     * Initialize the PRNG, the entropy context is static as the DRBG
+     * keeps a pointer to it for reseeding
+     */
 
-    entropy_init(&entropy);
-    sslerr = ctr_drbg_init(&ngx_ctr_drbg, entropy_func, &entropy,
+    entropy_init(&ngx_entropy);
+    sslerr = ctr_drbg_init(&ngx_ctr_drbg, entropy_func, &ngx_entropy,
                            ctr_drbg_custom, ngx_strlen(ctr_drbg_custom));
     if (sslerr != 0) {
         ngx_polarssl_error(NGX_LOG_EMERG, log, 0, sslerr,
@@ -88,12 +243,99 @@ ngx_ssl_init(ngx_log_t *log)
         return NGX_ERROR;
     }
 
-#if (NGX_THREADS)
-    ngx_ctr_drbg_mutex = ngx_mutex_init(log, 0);
-    if (ngx_ctr_drbg_mutex == NULL) {
+    return NGX_OK;
+}
+
+
+static void *
+ngx_polarssl_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_polarssl_conf_t  *pcf;
+
+    pcf = ngx_pcalloc(cycle->pool, sizeof(ngx_polarssl_conf_t));
+    if (pcf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&pcf->cache_files, cycle->pool, 1,
+                       sizeof(ngx_ssl_cache_file_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return pcf;
+}
+
+
+static ngx_int_t
+ngx_polarssl_init_module(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                i;
+    ngx_polarssl_conf_t      *pcf;
+    ngx_ssl_cache_file_t     *cfe;
+    ngx_ssl_session_cache_t  *cache;
+
+    if (ngx_test_config) {
+        return NGX_OK;
+    }
+
+    pcf = (ngx_polarssl_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                               ngx_polarssl_module);
+
+    /* a zone kept over a reconfiguration is loaded only once */
+
+    cfe = pcf->cache_files.elts;
+
+    for (i = 0; i < pcf->cache_files.nelts; i++) {
+        cache = cfe[i].shm_zone->data;
+
+        if (cache->loaded) {
+            continue;
+        }
+
+        cache->loaded = 1;
+
+        (void) ngx_polarssl_session_cache_load(cycle, &cfe[i]);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_polarssl_exit_master(ngx_cycle_t *cycle)
+{
+    ngx_ssl_session_cache_save(cycle);
+}
+
+
+static ngx_int_t
+ngx_polarssl_init_process(ngx_cycle_t *cycle)
+{
+    int  sslerr;
+
+    struct {
+        ngx_pid_t       pid;
+        ngx_msec_t      msec;
+    } additional;
+
+    /*
+     * Workers inherit the DRBG state of the master, reseed it with fresh
+     * entropy.  The pid is mixed in as well to tell the workers apart
+     * even if the entropy source misbehaves.
+     */
+
+    additional.pid = ngx_pid;
+    additional.msec = ngx_current_msec;
+
+    sslerr = ctr_drbg_reseed(&ngx_ctr_drbg, (unsigned char *) &additional,
+                             sizeof(additional));
+    if (sslerr != 0) {
+        ngx_polarssl_error(NGX_LOG_EMERG, cycle->log, 0, sslerr,
+                           "ctr_drbg_reseed() failed");
         return NGX_ERROR;
     }
-#endif
 
     return NGX_OK;
 }
@@ -139,15 +381,22 @@ ngx_ssl_create(ngx_ssl_t *ssl, ngx_uint_t protocols, void *data)
 
     /* Initialize the rest of the global state with sane defaults */
 
+    ssl->buffer_size = NGX_SSL_BUFSIZE;
+    ngx_memzero(&ssl->dyn_rec, sizeof(ngx_ssl_dyn_rec_t));
+
     ssl->ciphersuites = NULL;
     ngx_memset(&ssl->dhm_ctx, 0, sizeof(dhm_context));
-    ngx_memset(&ssl->own_cert, 0, sizeof(x509_crt));
-    ngx_memset(&ssl->own_key, 0, sizeof(rsa_context));
+#if defined(POLARSSL_ECP_C)
+    ssl->curves[0] = POLARSSL_ECP_DP_NONE;
+#endif
+    ssl->certificates = NULL;
     ngx_memset(&ssl->ca_cert, 0, sizeof(x509_crt));
     ngx_memset(&ssl->ca_crl, 0, sizeof(x509_crl));
-    ssl->have_own_cert = 0;
+    ssl->ticket_keys = NULL;
+    ssl->stat = NULL;
     ssl->have_ca_cert = 0;
     ssl->have_ca_crl = 0;
+    ssl->session_tickets = 1;
 
     ssl->ctx = ssl;
 
@@ -155,23 +404,63 @@ ngx_ssl_create(ngx_ssl_t *ssl, ngx_uint_t protocols, void *data)
 }
 
 
+ngx_int_t
+ngx_ssl_certificates(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *certs,
+    ngx_array_t *keys)
+{
+    ngx_str_t   *cert, *key;
+    ngx_uint_t   i;
+
+    cert = certs->elts;
+    key = keys->elts;
+
+    for (i = 0; i < certs->nelts; i++) {
+
+        if (ngx_ssl_certificate(cf, ssl, &cert[i], &key[i]) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
 ngx_int_t
 ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
     ngx_str_t *key)
 {
-    int  sslerr;
-    pk_context pk;
-    pk_init( &pk );
+    int                  sslerr;
+    ngx_ssl_key_cert_t  *kc;
+#if defined(POLARSSL_ECDSA_C)
+    size_t               len;
+    u_char               hash[32], sig[POLARSSL_MPI_MAX_SIZE];
+#endif
+
+    if (ssl->certificates == NULL) {
+        ssl->certificates = ngx_array_create(cf->pool, 2,
+                                             sizeof(ngx_ssl_key_cert_t));
+        if (ssl->certificates == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    kc = ngx_array_push(ssl->certificates);
+    if (kc == NULL) {
+        return NGX_ERROR;
+    }
+
+    x509_crt_init(&kc->cert);
+    pk_init(&kc->key);
 
     if (ngx_conf_full_name(cf->cycle, cert, 1) != NGX_OK) {
         return NGX_ERROR;
     }
 
-    sslerr = x509_crt_parse_file(&ssl->own_cert, (char *) cert->data);
+    sslerr = x509_crt_parse_file(&kc->cert, (char *) cert->data);
     if (sslerr != 0) {
         ngx_polarssl_error(NGX_LOG_EMERG, ssl->log, 0, sslerr,
                            "x509_crt_parse_file(%p, \"%s\") failed",
-                           &ssl->own_cert, cert->data);
+                           &kc->cert, cert->data);
         return NGX_ERROR;
     }
 
@@ -179,15 +468,76 @@ ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
         return NGX_ERROR;
     }
 
-    sslerr = pk_parse_keyfile( &pk, (char *) key->data, NULL);
+    sslerr = pk_parse_keyfile(&kc->key, (char *) key->data, NULL);
     if (sslerr != 0) {
         ngx_polarssl_error(NGX_LOG_EMERG, ssl->log, 0, sslerr,
                            "pk_parse_keyfile(%p, \"%s\", NULL) failed",
-                           &ssl->own_key, key->data);
+                           &kc->key, key->data);
+        return NGX_ERROR;
+    }
+
+    if (!pk_can_do(&kc->cert.pk, pk_get_type(&kc->key))) {
+        ngx_log_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "%s key \"%s\" does not match certificate \"%s\"",
+                      pk_get_name(&kc->key), key->data, cert->data);
         return NGX_ERROR;
     }
 
-    ssl->have_own_cert = 1;
+#if defined(POLARSSL_ECDSA_C)
+
+    /*
+     * ecp_mul_comb() builds the precomputed table of the key's curve on
+     * the first signature and stores it in the key without a lock, so two
+     * handshakes signing in threads at once would race on it: a signature
+     * is made here to build the table before any handshake
+     */
+
+    if (pk_can_do(&kc->key, POLARSSL_PK_ECDSA)) {
+        ngx_memzero(hash, 32);
+
+        sslerr = pk_sign(&kc->key, POLARSSL_MD_SHA256, hash, 32, sig, &len,
+                         ctr_drbg_random, &ngx_ctr_drbg);
+        if (sslerr != 0) {
+            ngx_polarssl_error(NGX_LOG_EMERG, ssl->log, 0, sslerr,
+                               "pk_sign(\"%s\") failed", key->data);
+            return NGX_ERROR;
+        }
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_use_certificates(ngx_ssl_conn_t *ssl_conn, ngx_ssl_t *ssl)
+{
+    int                  sslerr;
+    ngx_uint_t           i;
+    ngx_ssl_key_cert_t  *kc;
+
+    if (ssl->certificates == NULL) {
+        return NGX_OK;
+    }
+
+    /*
+     * Every certificate is handed to PolarSSL, which picks the first one
+     * usable with the negotiated ciphersuite: an ECDSA certificate is sent
+     * to clients agreeing on an ECDHE-ECDSA suite, and RSA one otherwise.
+     */
+
+    kc = ssl->certificates->elts;
+
+    for (i = 0; i < ssl->certificates->nelts; i++) {
+
+        sslerr = ssl_set_own_cert(ssl_conn, &kc[i].cert, &kc[i].key);
+        if (sslerr != 0) {
+            ngx_polarssl_error(NGX_LOG_ALERT, ssl->log, 0, sslerr,
+                               "ssl_set_own_cert() failed");
+            return NGX_ERROR;
+        }
+    }
 
     return NGX_OK;
 }
@@ -254,7 +604,8 @@ ngx_ssl_trusted_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
 ngx_int_t
 ngx_ssl_crl(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *crl)
 {
-    int  sslerr;
+    int        sslerr;
+    x509_crl  *cur;
 
     if (crl->len == 0) {
         return NGX_OK;
@@ -274,1020 +625,3597 @@ ngx_ssl_crl(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *crl)
 
     ssl->have_ca_crl = 1;
 
-    return NGX_ERROR;
-}
-
+    /*
+     * PolarSSL looks for a serial number by walking the whole CRL for
+     * every certificate verified, the CRLs are indexed instead and
+     * checked by ngx_polarssl_verify_crl(); like the CRL itself, the
+     * index is only rebuilt when the configuration is reloaded, changes
+     * to the file alone are not noticed
+     */
 
-ngx_int_t
-ngx_ssl_stapling(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file,
-    ngx_str_t *responder, ngx_uint_t verify)
-{
+    ssl->crl_index = ngx_array_create(cf->pool, 1,
+                                      sizeof(ngx_ssl_crl_index_t));
+    if (ssl->crl_index == NULL) {
+        return NGX_ERROR;
+    }
 
-    /* Not supported by PolarSSL */
+    for (cur = &ssl->ca_crl; cur; cur = cur->next) {
+        if (ngx_polarssl_crl_index(cf, ssl, cur) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
 
-    return NGX_ERROR;
+    return NGX_OK;
 }
 
 
-ngx_int_t
-ngx_ssl_stapling_resolver(ngx_conf_t *cf, ngx_ssl_t *ssl,
-        ngx_resolver_t *resolver, ngx_msec_t resolver_timeout)
+static ngx_int_t
+ngx_polarssl_crl_index(ngx_conf_t *cf, ngx_ssl_t *ssl, x509_crl *crl)
 {
+    x509_crt             *ca;
+    ngx_uint_t            n, size, i;
+    x509_crl_entry       *entry;
+    const md_info_t      *md_info;
+    ngx_ssl_crl_index_t  *index;
 
-    /* Not supported by PolarSSL */
+    if (crl->version == 0) {
+        return NGX_OK;
+    }
 
-    return NGX_ERROR;
-}
+    index = ngx_array_push(ssl->crl_index);
+    if (index == NULL) {
+        return NGX_ERROR;
+    }
 
+    index->crl = crl;
+    index->md_info = NULL;
+    index->issuer = NULL;
+    index->issuer_len = 0;
+    index->trusted = 0;
 
-ngx_int_t
-ngx_ssl_dhparam(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file)
-{
-    int  sslerr;
+    md_info = md_info_from_type(crl->sig_md);
 
-    static unsigned char dh1024_pem[] = {
-        "-----BEGIN DH PARAMETERS-----\n"
-        "MIGHAoGBALu8LcrYRnSQfEP89YDpz9vZWKP1aLQtSwju1OsPs1BMbAMCducQgAxc\n"
-        "y7qokiYUxb7spWWl/fHSh6K8BJvmd4Bg6RqSp1fjBI9osHb302zI8pul34HcLKcl\n"
-        "7OZicMyaUDXYzs7vnqAnSmOrHlj6/UmI0PZdFGdX2gcd8EXP4WubAgEC\n"
-        "-----END DH PARAMETERS-----"
-    };
+    if (md_info != NULL
+        && md(md_info, crl->tbs.p, crl->tbs.len, index->hash) == 0)
+    {
+        index->md_info = md_info;
 
+        for (ca = &ssl->ca_cert; ca; ca = ca->next) {
 
-    if (file->len == 0) {
-        sslerr = dhm_parse_dhm(&ssl->dhm_ctx, dh1024_pem,
-                               ngx_strlen(dh1024_pem));
-        if (sslerr != 0) {
-            ngx_polarssl_error(NGX_LOG_EMERG, ssl->log, 0, sslerr,
-                               "dhm_parse_dhm() failed");
+            if (ca->version == 0
+                || ca->subject_raw.len != crl->issuer_raw.len
+                || ngx_memcmp(ca->subject_raw.p, crl->issuer_raw.p,
+                              crl->issuer_raw.len)
+                   != 0)
+            {
+                continue;
+            }
 
-            return NGX_ERROR;
+            if (pk_verify(&ca->pk, crl->sig_md, index->hash, md_info->size,
+                          crl->sig.p, crl->sig.len)
+                == 0)
+            {
+                index->trusted = 1;
+                break;
+            }
         }
+    }
 
-        return NGX_OK;
+    if (md_info == NULL) {
+        ngx_log_error(NGX_LOG_WARN, ssl->log, 0,
+                      "CRL signature algorithm is not supported");
     }
 
-    if (ngx_conf_full_name(cf->cycle, file, 1) != NGX_OK) {
-        return NGX_ERROR;
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ssl->log, 0,
+                   "ssl crl signed by a CA certificate: %ui", index->trusted);
+
+    n = 0;
+
+    for (entry = &crl->entry; entry; entry = entry->next) {
+        if (entry->serial.len) {
+            n++;
+        }
     }
 
-    sslerr = dhm_parse_dhmfile(&ssl->dhm_ctx, (char *) file->data);
-    if (sslerr != 0) {
-        ngx_polarssl_error(NGX_LOG_EMERG, ssl->log, 0, sslerr,
-                           "dhm_parse_dhmfile(%p, \"%s\") failed",
-                           &ssl->dhm_ctx, file->data);
+    /* at most half of the table is used */
+
+    for (size = 8; size < 2 * n; size <<= 1) { /* void */ }
 
+    index->entries = ngx_pcalloc(cf->pool, size * sizeof(x509_crl_entry *));
+    if (index->entries == NULL) {
         return NGX_ERROR;
     }
 
-    return NGX_OK;
-}
+    index->mask = size - 1;
 
+    for (entry = &crl->entry; entry; entry = entry->next) {
 
-ngx_int_t
-ngx_ssl_ecdh_curve(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *name)
-{
+        if (entry->serial.len == 0) {
+            continue;
+        }
 
-    /* ECDH is not supported by PolarSSL */
-    
-    return NGX_OK;
-}
+        i = ngx_crc32_short(entry->serial.p, entry->serial.len) & index->mask;
 
+        while (index->entries[i]) {
+            i = (i + 1) & index->mask;
+        }
 
-ngx_int_t
-ngx_ssl_cipher_list(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *ciphers)
-{
-    return ngx_polarssl_set_cipher_list(ssl, (const char *) ciphers->data);
+        index->entries[i] = entry;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ssl->log, 0,
+                   "ssl crl index: %ui serials, %ui slots", n, size);
+
+    return NGX_OK;
 }
 
 
 void
-ngx_ssl_sni_fn(ngx_ssl_t *ssl, int (*sni_fn)(void *, ssl_context *,
-  const unsigned char *, size_t))
+ngx_ssl_use_ca_chain(ngx_ssl_connection_t *sc, ngx_ssl_t *ssl)
 {
-    ssl->sni_fn = sni_fn;
-}
+    ngx_ssl_conn_t  *ssl_conn;
 
+    ssl_conn = sc->connection;
 
-ngx_int_t
-ngx_ssl_session_cache(ngx_ssl_t *ssl, ngx_str_t *sess_ctx,
-    ssize_t builtin_session_cache, ngx_shm_zone_t *shm_zone, time_t timeout)
-{
+    ssl_set_ca_chain(ssl_conn, &ssl->ca_cert, NULL, NULL);
 
-    /*
-     * Setting up the session cache is done on a per connection basis
-     * like everything else in PolarSSL, so save the user provided
-     * setting till later, unless they want to use the builtin
-     * cache.
-     * 
-     * If they want to use the builtin cache, log an error because
-     * the builtin cache is not supported (and probably not worth
-     * supporting since it is rather trivial, and the one that this
-     * module provides is better within the context of ngnix).
-     */
+    if (ssl->crl_index) {
+        ssl_set_verify(ssl_conn, ngx_polarssl_verify_crl, ssl);
 
-    if (builtin_session_cache == NGX_SSL_DFLT_BUILTIN_SCACHE) {
-        ngx_log_error(NGX_LOG_EMERG, ssl->log, 0,
-                      "PolarSSL's builtin session cache is not supported.");
-        return NGX_ERROR;
-    }
-
-    ssl->builtin_session_cache = builtin_session_cache;
-
-    if (builtin_session_cache != NGX_SSL_NO_SCACHE) {
-        ssl->cache_shm_zone = shm_zone;
-        ssl->cache_ttl = timeout;
-    }
-
-    return NGX_OK;
-}
-
-
-ngx_int_t
-ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
-{
-    size_t                    len;
-    ngx_slab_pool_t          *shpool;
-    ngx_ssl_session_cache_t  *cache;
-
-    if (data) {
-        shm_zone->data = data;
-        return NGX_OK;
-    }
-
-    if (shm_zone->shm.exists) {
-        shm_zone->data = data;
-        return NGX_OK;
+    } else {
+        ssl_set_verify(ssl_conn, NULL, NULL);
     }
 
     /*
-     * Much like ngx_event_openssl, we use a red-black tree and a queue as
-     * the backing store for our cache.
+     * ngx_event_openssl has the callback rigged to allow the handshake
+     * to continue even if verification fails.  We shall do the same.
      */
 
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
-
-    cache = ngx_slab_alloc(shpool, sizeof(ngx_ssl_session_cache_t));
-    if (cache == NULL) {
-        return NGX_ERROR;
-    }
-   
-    shpool->data = cache; 
-    shm_zone->data = cache;
-
-    ngx_rbtree_init(&cache->session_rbtree, &cache->sentinel,
-                    ngx_ssl_session_rbtree_insert_value);
-
-    ngx_queue_init(&cache->expire_queue);
+    ssl_set_authmode(ssl_conn, SSL_VERIFY_OPTIONAL);
 
-    len = sizeof(" in SSL session shared cache \"\"") + shm_zone->shm.name.len;
+    if (ssl->verify_cache_shm_zone && ssl_conn->endpoint == SSL_IS_SERVER) {
+        sc->verify_cache = ssl;
 
-    shpool->log_ctx = ngx_slab_alloc(shpool, len);
-    if (shpool->log_ctx == NULL) {
-        return NGX_ERROR;
+    } else {
+        sc->verify_cache = NULL;
     }
-
-    ngx_sprintf(shpool->log_ctx, " in SSL session shared cache \"%V\"%Z",
-                &shm_zone->shm.name);
-
-    return NGX_OK;
 }
 
-ngx_int_t
-ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
-{
-    if (paths) {
-        ngx_log_error(NGX_LOG_WARN, ssl->log, 0,
-                      "\"ssl_session_ticket_keys\" ignored, not supported");
-    }
-
-    return NGX_OK;
-}
 
-void
-ngx_ssl_remove_cached_session(ngx_ssl_t *ssl, ngx_ssl_session_t *sess)
+static int
+ngx_polarssl_verify_crl(void *data, x509_crt *crt, int depth, int *flags)
 {
-    ngx_shm_zone_t           *shm_zone;
-    ngx_slab_pool_t          *shpool;
-    ngx_ssl_session_cache_t  *cache;
-    ngx_rbtree_node_t        *node, *sentinel;
-    ngx_ssl_sess_id_t        *sess_id;
-    int                       rc;
-    uint32_t                  hash;
+    ngx_ssl_t  *ssl = data;
 
-    shm_zone = ssl->cache_shm_zone;
-    if (shm_zone == NULL) {
-        return;
-    }
+    ngx_uint_t            n, i;
+    x509_crl             *crl;
+    x509_crl_entry       *entry;
+    ngx_ssl_crl_index_t  *index;
 
-    shpool = (ngx_slab_pool_t*) shm_zone->shm.addr;
-    cache = shm_zone->data;
+    /* the same checks as x509_crt_verifycrl() does for the issuer's CRLs */
 
-    hash = ngx_crc32_short(sess->id, sess->length);
+    index = ssl->crl_index->elts;
 
-    ngx_shmtx_lock(&shpool->mutex);
+    for (n = 0; n < ssl->crl_index->nelts; n++) {
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+        crl = index[n].crl;
 
-    while (node != sentinel) {
-        
-        if (hash < node->key) {
-            node = node->left;
+        if (crl->issuer_raw.len != crt->issuer_raw.len
+            || ngx_memcmp(crl->issuer_raw.p, crt->issuer_raw.p,
+                          crt->issuer_raw.len)
+               != 0)
+        {
             continue;
         }
 
-        if (hash > node->key) {
-            node = node->right;
-            continue;
+        if (!index[n].trusted
+            && ngx_polarssl_verify_crl_issuer(ssl, &index[n], crt) != NGX_OK)
+        {
+            *flags |= BADCRL_NOT_TRUSTED;
+            break;
         }
 
-        /* hash == node->key */
+        if (x509_time_expired(&crl->next_update)) {
+            *flags |= BADCRL_EXPIRED;
+        }
 
-        sess_id = (ngx_ssl_sess_id_t *) node;
+        if (x509_time_future(&crl->this_update)) {
+            *flags |= BADCRL_FUTURE;
+        }
+
+        if (crt->serial.len == 0) {
+            continue;
+        }
 
-        rc = ngx_memn2cmp(sess->id, sess_id->session->id, sess->length,
-                node->data);
+        i = ngx_crc32_short(crt->serial.p, crt->serial.len) & index[n].mask;
 
-        if (rc == 0) {
-            ngx_queue_remove(&sess_id->queue);
+        for ( ;; ) {
+            entry = index[n].entries[i];
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
+            if (entry == NULL) {
+                break;
+            }
 
-            ngx_slab_free_locked(shpool, sess_id->session);
+            if (entry->serial.len == crt->serial.len
+                && ngx_memcmp(entry->serial.p, crt->serial.p,
+                              crt->serial.len)
+                   == 0)
+            {
+                if (x509_time_expired(&entry->revocation_date)) {
+                    *flags |= BADCERT_REVOKED;
+                }
 
-            ngx_slab_free_locked(shpool, sess_id);
+                break;
+            }
 
-            goto done;
+            i = (i + 1) & index[n].mask;
         }
-
-        node = (rc < 0) ? node->left : node->right;
     }
 
-done:
-    ngx_shmtx_unlock(&shpool->mutex);
+    return 0;
 }
 
 
-static int
-ngx_polarssl_get_cache(void *ctx, ssl_session *session)
+static ngx_int_t
+ngx_polarssl_verify_crl_issuer(ngx_ssl_t *ssl, ngx_ssl_crl_index_t *index,
+    x509_crt *crt)
 {
-    ngx_shm_zone_t           *shm_zone;
-    ngx_slab_pool_t          *shpool;
-    ngx_ssl_session_cache_t  *cache;
-    ngx_rbtree_node_t        *node, *sentinel;
-    ngx_ssl_sess_id_t        *sess_id;
-    time_t                    expires;
-    int                       rc;
-    uint32_t                  hash;
-
-    if (ctx == NULL) {
-        /* NGX_SSL_NONE_SCACHE: Every search is a cache miss */
-        return 1;
-    }
+    u_char    *p;
+    x509_crl  *crl;
+    x509_crt  *issuer;
 
-    hash = ngx_crc32_short(session->id, session->length);
+    crl = index->crl;
 
-    shm_zone = ctx;
-    shpool = (ngx_slab_pool_t*) shm_zone->shm.addr;
-    cache = shm_zone->data;
+    if (index->md_info == NULL) {
+        return NGX_DECLINED;
+    }
 
-    ngx_shmtx_lock(&shpool->mutex);
+    /*
+     * the issuer of a certificate follows it in the chain, as
+     * x509_crt_verify() looks for the parent there too
+     */
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+    for (issuer = crt->next; issuer; issuer = issuer->next) {
 
-    while (node != sentinel) {
-        
-        if (hash < node->key) {
-            node = node->left;
+        if (issuer->version == 0
+            || issuer->subject_raw.len != crl->issuer_raw.len
+            || ngx_memcmp(issuer->subject_raw.p, crl->issuer_raw.p,
+                          crl->issuer_raw.len)
+               != 0)
+        {
             continue;
         }
 
-        if (hash > node->key) {
-            node = node->right;
-            continue;
+        if (index->issuer
+            && index->issuer_len == issuer->raw.len
+            && ngx_memcmp(index->issuer, issuer->raw.p, issuer->raw.len) == 0)
+        {
+            return NGX_OK;
         }
 
-        /* hash == node->key */
+        if (pk_verify(&issuer->pk, crl->sig_md, index->hash,
+                      index->md_info->size, crl->sig.p, crl->sig.len)
+            != 0)
+        {
+            continue;
+        }
 
-        sess_id = (ngx_ssl_sess_id_t *) node;
+        /* the verified issuer is kept for the lifetime of the worker */
 
-        rc = ngx_memn2cmp(session->id, sess_id->session->id, session->length,
-                node->data);
+        p = ngx_alloc(issuer->raw.len, ssl->log);
 
-        if (rc == 0) {
+        if (p) {
+            ngx_memcpy(p, issuer->raw.p, issuer->raw.len);
 
-            if (session->ciphersuite != sess_id->session->ciphersuite ||
-                session->compression != sess_id->session->compression ||
-                session->length != sess_id->session->length) {
-                /* The ciphersuite/compression changed out from under us */
-                goto done;
+            if (index->issuer) {
+                ngx_free(index->issuer);
             }
 
-            /* Check the expiry time */
-
-            expires = (time_t) sess_id->session->peer_cert;
-            if (expires > ngx_time()) {
-                /* Cache hit */
+            index->issuer = p;
+            index->issuer_len = issuer->raw.len;
+        }
 
-                ngx_memcpy(session->master, sess_id->session->master, 48);
+        return NGX_OK;
+    }
 
-                ngx_shmtx_unlock(&shpool->mutex);
+    return NGX_DECLINED;
+}
 
-                return 0;
-            }
 
-            /* Cache entry expired */
+ngx_int_t
+ngx_ssl_verify_cache(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_shm_zone_t *shm_zone,
+    time_t timeout)
+{
+    x509_crt        *crt;
+    x509_crl        *crl;
+    sha256_context   sha;
 
-            ngx_queue_remove(&sess_id->queue);
+    if (shm_zone == NULL || !ssl->have_ca_cert) {
+        return NGX_OK;
+    }
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
+    /*
+     * The CA certificates and CRLs are hashed into every key, so entries
+     * verified against other ones, e.g. before the CRL was reloaded,
+     * are never found and just expire.
+     */
 
-            ngx_slab_free_locked(shpool, sess_id->session);
+    sha256_starts(&sha, 0);
 
-            ngx_slab_free_locked(shpool, sess_id);
+    for (crt = &ssl->ca_cert; crt; crt = crt->next) {
+        sha256_update(&sha, crt->raw.p, crt->raw.len);
+    }
 
-            goto done;
+    if (ssl->have_ca_crl) {
+        for (crl = &ssl->ca_crl; crl; crl = crl->next) {
+            sha256_update(&sha, crl->raw.p, crl->raw.len);
         }
-
-        node = (rc < 0) ? node->left : node->right;
     }
 
-done:
-    ngx_shmtx_unlock(&shpool->mutex);
+    sha256_finish(&sha, ssl->verify_cache_ctx);
 
-    return 1;
+    ssl->verify_cache_shm_zone = shm_zone;
+    ssl->verify_cache_ttl = timeout;
+
+    return NGX_OK;
 }
 
 
-static int
-ngx_polarssl_set_cache(void *ctx, const ssl_session *session)
+ngx_int_t
+ngx_ssl_verify_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 {
-    ngx_shm_zone_t           *shm_zone;
-    ngx_slab_pool_t          *shpool;
-    ngx_ssl_session_cache_t  *cache;
-    ngx_ssl_sess_id_t        *sess_id;
-    ngx_ssl_session_t        *cached_sess;
-    uint32_t                  hash;
+    size_t                   len;
+    ngx_slab_pool_t         *shpool;
+    ngx_ssl_verify_cache_t  *cache;
 
-    if (ctx == NULL) {
-        /* NGX_SSL_NONE_SCACHE: Never cache any entries, but pretend to do so. */
-        return 0;
+    if (data) {
+        shm_zone->data = data;
+        return NGX_OK;
     }
 
-    shm_zone = ctx;
-    shpool = (ngx_slab_pool_t*) shm_zone->shm.addr;
-    cache = shm_zone->data;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
-    ngx_shmtx_lock(&shpool->mutex);
+    if (shm_zone->shm.exists) {
+        shm_zone->data = shpool->data;
+        return NGX_OK;
+    }
 
-    /*
-     * Because we need to store the entire ssl_session, in the cache we allocate
-     * the entry and the ssl_session separately.  The entry is 64 bytes in size
-     * on 64 bit architectures, and ssl_session is 112 bytes.
-     *
-     * Since we explicitly do not cache the peer certificate (requires a deep
-     * copy), we hijack session.peer_cert and use that to store the expiration
-     * time.  As far as I know sizeof(void *) == sizeof(time_t) is a reasonable
-     * assumption to make.  This doesn't actually save anything on 64 bit
-     * systems, but it *may* on 32 bit and it's not practical to break up a
-     * ssl_session without being vulnerable to PolarSSL code changes.
-     */
+    cache = ngx_slab_alloc(shpool, sizeof(ngx_ssl_verify_cache_t));
+    if (cache == NULL) {
+        return NGX_ERROR;
+    }
 
-    /* Prune some sessions from the cache to ensure the allocation succeds */
-    
-    ngx_ssl_expire_sessions(cache, shpool, 1);
+    cache->shpool = shpool;
 
-    cached_sess = ngx_slab_alloc_locked(shpool, sizeof(ngx_ssl_session_t));
-    if (cached_sess == NULL) {
+    ngx_rbtree_init(&cache->rbtree, &cache->sentinel,
+                    ngx_ssl_verify_rbtree_insert_value);
 
-        /* Prune the oldest non-expired session, and try again */
+    ngx_queue_init(&cache->expire_queue);
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+    shpool->data = cache;
+    shm_zone->data = cache;
 
-        cached_sess = ngx_slab_alloc_locked(shpool, sizeof(ngx_ssl_session_t));
-        if (cached_sess == NULL) {
-            goto failed;
-        }
-    }
+    len = sizeof(" in SSL verify shared cache \"\"") + shm_zone->shm.name.len;
 
-    sess_id = ngx_slab_alloc_locked(shpool, sizeof(ngx_ssl_sess_id_t));
-    if (sess_id == NULL) {
-        goto failed;
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
     }
 
-    memcpy(cached_sess, session, sizeof(ngx_ssl_session_t));
-    cached_sess->peer_cert = (x509_crt *) (ngx_time() + cache->ttl);
-
-    hash = ngx_crc32_short(cached_sess->id, cached_sess->length);
+    ngx_sprintf(shpool->log_ctx, " in SSL verify shared cache \"%V\"%Z",
+                &shm_zone->shm.name);
 
-    sess_id->node.key = hash;
-    sess_id->node.data = (u_char) cached_sess->length;
-    sess_id->session = cached_sess;
+    shpool->log_nomem = 0;
 
-    ngx_queue_insert_head(&cache->expire_queue, &sess_id->queue);
+    return NGX_OK;
+}
 
-    ngx_rbtree_insert(&cache->session_rbtree, &sess_id->node);
 
-    ngx_shmtx_unlock(&shpool->mutex);
+ngx_int_t
+ngx_ssl_stapling(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file,
+    ngx_str_t *responder, ngx_uint_t verify)
+{
 
-    return 0;
+    /*
+     * PolarSSL neither parses the "status_request" extension nor is able
+     * to send the CertificateStatus handshake message, so there is no way
+     * to staple an OCSP response, even a prefetched one.  Do the same as
+     * ngx_event_openssl_stapling does with OpenSSL libraries without OCSP
+     * support, and do not fail the configuration.
+     */
 
-failed:
-    ngx_shmtx_unlock(&shpool->mutex);
+    ngx_log_error(NGX_LOG_WARN, ssl->log, 0,
+                  "\"ssl_stapling\" ignored, not supported");
 
-    return 1;
+    return NGX_OK;
 }
 
 
-static void
-ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
-     ngx_slab_pool_t *shpool, ngx_uint_t n)
+ngx_int_t
+ngx_ssl_stapling_resolver(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_resolver_t *resolver, ngx_msec_t resolver_timeout)
 {
-    time_t              now, then;
-    ngx_queue_t        *q;
-    ngx_ssl_sess_id_t  *sess_id;
+    return NGX_OK;
+}
 
-    now = ngx_time();
 
-    while (n < 3) {
-        
-        if (ngx_queue_empty(&cache->expire_queue)) {
-            return;
-        }
+ngx_int_t
+ngx_ssl_dhparam(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file)
+{
+    int  sslerr;
 
-        q = ngx_queue_last(&cache->expire_queue);
+    static unsigned char dh1024_pem[] = {
+        "-----BEGIN DH PARAMETERS-----\n"
+        "MIGHAoGBALu8LcrYRnSQfEP89YDpz9vZWKP1aLQtSwju1OsPs1BMbAMCducQgAxc\n"
+        "y7qokiYUxb7spWWl/fHSh6K8BJvmd4Bg6RqSp1fjBI9osHb302zI8pul34HcLKcl\n"
+        "7OZicMyaUDXYzs7vnqAnSmOrHlj6/UmI0PZdFGdX2gcd8EXP4WubAgEC\n"
+        "-----END DH PARAMETERS-----"
+    };
 
-        sess_id = ngx_queue_data(q, ngx_ssl_sess_id_t, queue);
 
-        then = (time_t) sess_id->session->peer_cert;
-        if (n++ != 0 && then > now) {
-            return;
+    if (file->len == 0) {
+        sslerr = dhm_parse_dhm(&ssl->dhm_ctx, dh1024_pem,
+                               ngx_strlen(dh1024_pem));
+        if (sslerr != 0) {
+            ngx_polarssl_error(NGX_LOG_EMERG, ssl->log, 0, sslerr,
+                               "dhm_parse_dhm() failed");
+
+            return NGX_ERROR;
         }
 
-        ngx_queue_remove(q);
+        return NGX_OK;
+    }
 
-        ngx_rbtree_delete(&cache->session_rbtree, &sess_id->node);
+    if (ngx_conf_full_name(cf->cycle, file, 1) != NGX_OK) {
+        return NGX_ERROR;
+    }
 
-        ngx_slab_free_locked(shpool, sess_id->session);
+    sslerr = dhm_parse_dhmfile(&ssl->dhm_ctx, (char *) file->data);
+    if (sslerr != 0) {
+        ngx_polarssl_error(NGX_LOG_EMERG, ssl->log, 0, sslerr,
+                           "dhm_parse_dhmfile(%p, \"%s\") failed",
+                           &ssl->dhm_ctx, file->data);
 
-        ngx_slab_free_locked(shpool, sess_id);
+        return NGX_ERROR;
     }
+
+    return NGX_OK;
 }
 
 
-static void
-ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
-    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+ngx_int_t
+ngx_ssl_ecdh_curve(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *name)
 {
-    ngx_rbtree_node_t  **p;
-    ngx_ssl_sess_id_t   *sess_id, *sess_id_temp;
+#if defined(POLARSSL_ECDH_C)
 
-    for ( ;; ) {
+    u_char                *p, *last, *end;
+    ngx_uint_t             n;
+    const ecp_curve_info  *curve;
+    u_char                 curve_name[POLARSSL_ECP_CURVE_MAX_LENGTH];
 
-        if (node->key < temp->key) {
+    /*
+     * The value is a colon separated list of curves in order of
+     * preference, both OpenSSL and PolarSSL curve names are accepted.
+     */
 
-            p = &temp->left;
+    n = 0;
+    p = name->data;
+    last = name->data + name->len;
 
-        } else if (node->key > temp->key) {
+    while (p < last) {
 
-            p = &temp->right;
+        end = ngx_strlchr(p, last, ':');
+        if (end == NULL) {
+            end = last;
+        }
 
-        } else { /* node->key == temp->key */
+        if (end - p >= POLARSSL_ECP_CURVE_MAX_LENGTH) {
+            goto unknown;
+        }
 
-            sess_id = (ngx_ssl_sess_id_t *) node;
-            sess_id_temp = (ngx_ssl_sess_id_t *) temp;
+        ngx_cpystrn(curve_name, p, end - p + 1);
 
-            p = (ngx_memn2cmp(sess_id->session->id, sess_id_temp->session->id,
-                              (size_t) node->data, (size_t) temp->data)
-                 < 0) ? &temp->left : &temp->right;
+        if (ngx_strcmp(curve_name, "prime256v1") == 0) {
+            curve = ecp_curve_info_from_name("secp256r1");
+
+        } else if (ngx_strcmp(curve_name, "prime192v1") == 0) {
+            curve = ecp_curve_info_from_name("secp192r1");
+
+        } else {
+            curve = ecp_curve_info_from_name((char *) curve_name);
         }
 
-        if (*p == sentinel) {
-            break;
+        if (curve == NULL) {
+            goto unknown;
         }
 
-        temp = *p;
-    }
+        if (n == NGX_SSL_MAX_CURVES) {
+            ngx_log_error(NGX_LOG_EMERG, ssl->log, 0,
+                          "too many curves in \"%V\"", name);
+            return NGX_ERROR;
+        }
 
-    *p = node;
-    node->parent = temp;
-    node->left = sentinel;
-    node->right = sentinel;
-    ngx_rbt_red(node);
-}
+        ssl->curves[n++] = curve->grp_id;
 
+        p = end + 1;
+    }
 
-ngx_int_t
-ngx_ssl_set_session(ngx_connection_t *c, ngx_ssl_session_t *session)
-{
-    
-    /*
-     * TODO: ngx_http_upstream_round_robin uses this to set a SSL session to
-     * allow session reuse.
-     *
-     * PolarSSL has ssl_set_session, but it does the copy on set.  The module
-     * that actually uses this increments a refcount in ngx_ssl_get_session
-     * instead so implementing this is requires more understanding of how
-     * ngx_http_upstream_round_robin works.
-     */
+    ssl->curves[n] = POLARSSL_ECP_DP_NONE;
 
     return NGX_OK;
-}
 
+unknown:
 
-ngx_ssl_session_t*
-ngx_ssl_get_session(ngx_connection_t *c)
-{
+    ngx_log_error(NGX_LOG_EMERG, ssl->log, 0,
+                  "Unknown curve name \"%*s\"", end - p, p);
+    return NGX_ERROR;
 
-    /* TODO: ngx_http_upstream_round_robin uses this to copy a SSL session */
+#else
 
-    return NULL;
-}
+    /* PolarSSL was built without ECDH support */
 
+    return NGX_OK;
 
-ngx_ssl_session_t *
-ngx_ssl_peek_session(ngx_connection_t *c)
-{
-    return c->ssl->connection->session;
+#endif
 }
 
 
-void
-ngx_ssl_free_session(ngx_ssl_session_t *session)
+ngx_int_t
+ngx_ssl_cipher_list(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *ciphers)
 {
-
-    /* TODO: ngx_http_upstream_round_robin uses this to free a copied SSL session */
+    return ngx_polarssl_set_cipher_list(ssl, (const char *) ciphers->data);
 }
 
 
-ngx_int_t
-ngx_ssl_have_peer_cert(ngx_connection_t *c)
+void
+ngx_ssl_sni_fn(ngx_ssl_t *ssl, int (*sni_fn)(void *, ssl_context *,
+  const unsigned char *, size_t))
 {
-    if (ssl_get_peer_cert(c->ssl->connection) != NULL) {
-        return NGX_OK;
-    }
-
-    return NGX_ERROR;
+    ssl->sni_fn = sni_fn;
 }
 
 
+#if (NGX_THREAD_POOL)
+
 ngx_int_t
-ngx_ssl_verify_result(ngx_connection_t *c, long *rc, const char **errstr)
+ngx_ssl_thread_pool(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_thread_pool_t *tp)
 {
-    int  sslerr;
+#if !defined(POLARSSL_THREADING_C)
 
-    sslerr = ssl_get_verify_result(c->ssl->connection);
+    /*
+     * RSA blinding updates the shared private key, PolarSSL serializes
+     * this with a mutex only if it is built with threading support
+     */
 
-    if (sslerr != 0) {
-        *rc = sslerr;
-        *errstr = ngx_polarssl_verify_error_str(sslerr);
+    ngx_log_error(NGX_LOG_EMERG, ssl->log, 0,
+                  "\"ssl_thread_pool\" requires PolarSSL built "
+                  "with POLARSSL_THREADING_C");
 
-        return NGX_ERROR;
-    }
+    return NGX_ERROR;
 
-    return NGX_OK;
-}
+#else
 
+    ssl->thread_pool = tp;
 
-ngx_int_t
-ngx_ssl_get_protocol(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
-{
-    s->data = (u_char *) ssl_get_version(c->ssl->connection);
     return NGX_OK;
-}
 
-
-ngx_int_t
-ngx_ssl_get_cipher_name(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
-{
-    s->data = (u_char *) ssl_get_ciphersuite(c->ssl->connection);
-    return NGX_OK;
+#endif
 }
 
+#endif
+
 
 ngx_int_t
-ngx_ssl_get_session_id(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+ngx_ssl_session_cache(ngx_ssl_t *ssl, ngx_str_t *sess_ctx,
+    ssize_t builtin_session_cache, ngx_shm_zone_t *shm_zone, time_t timeout)
 {
-    ssl_session  *session = c->ssl->connection->session;
 
     /*
-     * ngx_event_openssl's implementation of this returns a hexdump of
-     * the ASN.1 encoded SSL session object.  Our implementation just
-     * returns a hexdump of the session id, because this routine is not
-     * named ngx_ssl_get_entire_session_object.
+     * Setting up the session cache is done on a per connection basis
+     * like everything else in PolarSSL, so save the user provided
+     * setting till later, unless they want to use the builtin
+     * cache.
+     * 
+     * If they want to use the builtin cache, log an error because
+     * the builtin cache is not supported (and probably not worth
+     * supporting since it is rather trivial, and the one that this
+     * module provides is better within the context of ngnix).
      */
 
-    s->len = session->length * 2;
-    s->data = ngx_pnalloc(pool, s->len);
-    if (s->data == NULL) {
+    if (builtin_session_cache == NGX_SSL_DFLT_BUILTIN_SCACHE) {
+        ngx_log_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "PolarSSL's builtin session cache is not supported.");
         return NGX_ERROR;
     }
 
-    ngx_hex_dump(s->data, session->id, session->length);
+    ssl->builtin_session_cache = builtin_session_cache;
+    ssl->cache_ttl = timeout;
+
+    if (builtin_session_cache != NGX_SSL_NO_SCACHE) {
+        ssl->cache_shm_zone = shm_zone;
+    }
 
     return NGX_OK;
 }
 
 
 ngx_int_t
-ngx_ssl_get_raw_certificate(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 {
-    static const int            header_len = 29;
-    static const int            footer_len = 25;
-    static const unsigned char  pem_header[] = { "-----BEGIN CERTIFICATE-----\r\n" };
-    static const unsigned char  pem_footer[] = { "-----END CERTIFICATE-----" };
-    size_t                      len = 0, i;
-    const x509_crt            *cert;
-    unsigned char              *p = NULL;
+    size_t                    len, size;
+    ngx_uint_t                i, n;
+    ngx_slab_pool_t          *shpool, *sp;
+    ngx_ssl_session_cache_t  *cache;
 
-    /*
-     * PolarSSL does not have a built in routine to write certificates
-     * in PEM format.  Thankfully it's relatively easy to do since it
-     * keeps a copy of the DER format certificate around.
-     */
+    shm_zone->unlock = ngx_ssl_session_cache_unlock;
 
-    cert = ssl_get_peer_cert(c->ssl->connection);
-    if (cert == NULL || cert->raw.len == 0) {
+    if (data) {
+        shm_zone->data = data;
         return NGX_OK;
     }
 
-    /* Determine how much buffer space is required */
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
-    base64_encode(p, &len, cert->raw.p, cert->raw.len);
-    len += (len / 64 + 1) * 2;
-    len += header_len;
-    len += footer_len;
+    if (shm_zone->shm.exists) {
+        shm_zone->data = shpool->data;
+        return NGX_OK;
+    }
 
-    p = s->data = ngx_pnalloc(pool, len);
-    if (s->data == NULL) {
+    cache = ngx_slab_alloc(shpool, sizeof(ngx_ssl_session_cache_t));
+    if (cache == NULL) {
         return NGX_ERROR;
     }
 
-    /* Append the header */
+    cache->loaded = 0;
 
-    ngx_memcpy(p, pem_header, header_len);
-    p += header_len;
+    shpool->data = cache;
+    shm_zone->data = cache;
 
-    /* Base64 encode the cert, inserting newlines every 64 characters. */
+    len = sizeof(" in SSL session shared cache \"\"") + shm_zone->shm.name.len;
 
-    for (i = 0; i < cert->raw.len; /* i incremented in body */) {
-        size_t to_encode = (cert->raw.len - i > 48) ? 48 : cert->raw.len - i;
-        size_t dlen = len - (p - s->data);
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
 
-        base64_encode(p, &dlen, cert->raw.p + i, to_encode);
+    ngx_sprintf(shpool->log_ctx, " in SSL session shared cache \"%V\"%Z",
+                &shm_zone->shm.name);
 
-        p += dlen;
-        *p++ = '\r';
-        *p++ = '\n';
+    /*
+     * The cache is split into shards selected by the session id hash.
+     * Each shard is a slab pool of its own carved out of the zone, so
+     * lookups and inserts into different shards do not contend for a
+     * single mutex.  Without atomic operations a shard would need a lock
+     * file, so the zone itself is used as the only shard.
+     */
 
-        i+= to_encode;
+    n = 1;
+
+#if (NGX_HAVE_ATOMIC_OPS)
+
+    n = (shm_zone->shm.size >> ngx_pagesize_shift) / 64;
+
+    if (n > NGX_SSL_SESSION_CACHE_SHARDS) {
+        n = NGX_SSL_SESSION_CACHE_SHARDS;
     }
 
-    /* Append the footer */
+#endif
 
-    ngx_memcpy(p, pem_footer, footer_len);
-    p += footer_len;
-    *p = '\0';
+    if (n < 2) {
+        cache->shards[0] = ngx_ssl_session_shard_init(shpool);
+        if (cache->shards[0] == NULL) {
+            return NGX_ERROR;
+        }
 
-    s->len = ngx_strlen(s->data);
+        cache->nshards = 1;
 
-    return NGX_OK;
-}
+        return NGX_OK;
+    }
 
+    /* leave room for the page descriptors of the zone and the above */
 
-ngx_int_t
-ngx_ssl_get_certificate(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
-{
+    size = shm_zone->shm.size - shm_zone->shm.size / 64 - 4 * ngx_pagesize;
+    size = (size / n) & ~((size_t) ngx_pagesize - 1);
 
-    /*
-     * As far as I can tell, both of ngx_ssl_get_certificate and
-     * ngx_ssl_get_raw_certificate just return the peer certificate
-     * in PEM format, with ngx_ssl_get_certificate messing with
-     * whitespace.
-     *
-     * Since our PEM generator doesn't prefix any lines with whitespace
-     * at all, the functions can just return identical output.
-     */
+    for (i = 0; i < n; i++) {
 
-    return ngx_ssl_get_raw_certificate(c, pool, s);
-}
+        sp = ngx_slab_alloc(shpool, size);
+        if (sp == NULL) {
+            return NGX_ERROR;
+        }
 
+        sp->end = (u_char *) sp + size;
+        sp->min_shift = 3;
+        sp->addr = sp;
+        sp->class_locks = shpool->class_locks;
 
-ngx_int_t
-ngx_ssl_get_subject_dn(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
-{
-    const x509_crt  *cert;
-    int               len;
+        if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+            return NGX_ERROR;
+        }
 
-    cert = ssl_get_peer_cert(c->ssl->connection);
-    if (cert == NULL) {
-        return NGX_OK;
-    }
+        ngx_slab_init(sp);
 
-    s->data = ngx_pnalloc(pool, POLARSSL_DN_MAX_LENGTH);
-    if (s->data == NULL) {
-        return NGX_ERROR;
-    }
+        sp->log_ctx = shpool->log_ctx;
 
-    len = x509_dn_gets((char *) s->data, POLARSSL_DN_MAX_LENGTH - 1,
-                            &cert->subject);
-    if (len < 0) {
-        return NGX_ERROR;
+        cache->shards[i] = ngx_ssl_session_shard_init(sp);
+        if (cache->shards[i] == NULL) {
+            return NGX_ERROR;
+        }
     }
 
-    s->len = len;
+    cache->nshards = n;
 
     return NGX_OK;
 }
 
 
-ngx_int_t
-ngx_ssl_get_issuer_dn(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+static void
+ngx_ssl_session_cache_unlock(ngx_shm_zone_t *shm_zone, ngx_pid_t pid)
 {
-    const x509_crt  *cert;
-    int               len;
+    ngx_uint_t                i;
+    ngx_slab_pool_t          *sp;
+    ngx_ssl_session_cache_t  *cache;
 
-    cert = ssl_get_peer_cert(c->ssl->connection);
-    if (cert == NULL) {
-        return NGX_OK;
-    }
+    cache = shm_zone->data;
 
-    s->data = ngx_pnalloc(pool, POLARSSL_DN_MAX_LENGTH);
-    if (s->data == NULL) {
-        return NGX_ERROR;
+    if (cache == NULL) {
+        return;
     }
 
-    len = x509_dn_gets((char *) s->data, POLARSSL_DN_MAX_LENGTH - 1,
-                             &cert->issuer);
-    if (len < 0) {
-        return NGX_ERROR;
-    }
+    /* the zone pool itself is unlocked by ngx_unlock_mutexes() */
 
-    s->len = len;
+    for (i = 0; i < cache->nshards; i++) {
+        sp = cache->shards[i]->shpool;
 
-    return NGX_OK;
+        if (sp == (ngx_slab_pool_t *) shm_zone->shm.addr) {
+            continue;
+        }
+
+        if (ngx_slab_force_unlock(sp, pid)) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                          "shard %ui of shared memory zone \"%V\" "
+                          "was locked by %P", i, &shm_zone->shm.name, pid);
+        }
+    }
 }
 
 
-ngx_int_t
-ngx_ssl_get_serial_number(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+static ngx_ssl_session_shard_t *
+ngx_ssl_session_shard_init(ngx_slab_pool_t *shpool)
 {
-    const x509_crt  *cert;
-    int               len;
+    ngx_ssl_session_shard_t  *shard;
 
-    cert = ssl_get_peer_cert(c->ssl->connection);
-    if (cert == NULL) {
-        return NGX_OK;
+    shard = ngx_slab_alloc(shpool, sizeof(ngx_ssl_session_shard_t));
+    if (shard == NULL) {
+        return NULL;
     }
 
-    len = cert->serial.len * 3 + 1;
-    s->data = ngx_palloc(pool, len);
-    if (s->data == NULL) {
-        return NGX_ERROR;
+    shard->shpool = shpool;
+
+    ngx_rbtree_init(&shard->session_rbtree, &shard->sentinel,
+                    ngx_ssl_session_rbtree_insert_value);
+
+    ngx_queue_init(&shard->expire_queue);
+
+    shard->sessions = 0;
+    shard->hits = 0;
+    shard->misses = 0;
+    shard->evictions = 0;
+
+    /* a full shard is expected, the oldest sessions are evicted then */
+
+    shpool->log_nomem = 0;
+
+    return shard;
+}
+
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+
+ngx_int_t
+ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
+{
+    int                            sslerr;
+    u_char                         buf[48];
+    ssize_t                        n;
+    ngx_str_t                     *path;
+    ngx_file_t                     file;
+    ngx_uint_t                     i;
+    ngx_array_t                   *keys;
+    ngx_file_info_t                fi;
+    ngx_ssl_session_ticket_key_t  *key;
+
+    if (!ssl->session_tickets) {
+        return NGX_OK;
     }
 
-    len = x509_serial_gets((char *) s->data, len - 1, &cert->serial);
-    if (len < 0) {
+    /*
+     * The keys are never copied once initialized as the AES contexts
+     * point into themselves, so the array is allocated to its final size.
+     */
+
+    keys = ngx_array_create(cf->pool, paths ? paths->nelts : 1,
+                            sizeof(ngx_ssl_session_ticket_key_t));
+    if (keys == NULL) {
         return NGX_ERROR;
     }
 
-    s->len = len;
+    if (paths == NULL) {
+
+        /*
+         * No key files were specified: generate a key here, in the master
+         * process, so that all worker processes inherit and agree on it.
+         */
+
+        sslerr = ctr_drbg_random(&ngx_ctr_drbg, buf, 48);
+        if (sslerr != 0) {
+            ngx_polarssl_error(NGX_LOG_EMERG, ssl->log, 0, sslerr,
+                               "ctr_drbg_random() failed");
+            return NGX_ERROR;
+        }
+
+        key = ngx_array_push(keys);
+        if (key == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_ssl_session_ticket_key_init(key, buf);
+
+        ssl->ticket_keys = keys;
+
+        return NGX_OK;
+    }
+
+    path = paths->elts;
+    for (i = 0; i < paths->nelts; i++) {
+
+        if (ngx_conf_full_name(cf->cycle, &path[i], 1) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ngx_memzero(&file, sizeof(ngx_file_t));
+        file.name = path[i];
+        file.log = cf->log;
+
+        file.fd = ngx_open_file(file.name.data, NGX_FILE_RDONLY, 0, 0);
+        if (file.fd == NGX_INVALID_FILE) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                               ngx_open_file_n " \"%V\" failed", &file.name);
+            return NGX_ERROR;
+        }
+
+        if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+            ngx_conf_log_error(NGX_LOG_CRIT, cf, ngx_errno,
+                               ngx_fd_info_n " \"%V\" failed", &file.name);
+            goto failed;
+        }
+
+        if (ngx_file_size(&fi) != 48) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"%V\" must be 48 bytes", &file.name);
+            goto failed;
+        }
+
+        n = ngx_read_file(&file, buf, 48, 0);
+
+        if (n == NGX_ERROR) {
+            ngx_conf_log_error(NGX_LOG_CRIT, cf, ngx_errno,
+                               ngx_read_file_n " \"%V\" failed", &file.name);
+            goto failed;
+        }
+
+        if (n != 48) {
+            ngx_conf_log_error(NGX_LOG_CRIT, cf, 0,
+                               ngx_read_file_n " \"%V\" returned only "
+                               "%z bytes instead of 48", &file.name, n);
+            goto failed;
+        }
+
+        key = ngx_array_push(keys);
+        if (key == NULL) {
+            goto failed;
+        }
+
+        ngx_ssl_session_ticket_key_init(key, buf);
+
+        if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                          ngx_close_file_n " \"%V\" failed", &file.name);
+        }
+    }
+
+    /*
+     * The first key is used to encrypt new tickets, the others
+     * are only used to decrypt tickets issued before a key rotation.
+     */
+
+    ssl->ticket_keys = keys;
 
     return NGX_OK;
+
+failed:
+
+    ngx_memzero(buf, 48);
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%V\" failed", &file.name);
+    }
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_ssl_session_ticket_key_init(ngx_ssl_session_ticket_key_t *key, u_char *buf)
+{
+    ngx_memcpy(key->key_name, buf, 16);
+    aes_setkey_enc(&key->enc, buf + 16, 128);
+    aes_setkey_dec(&key->dec, buf + 16, 128);
+    ngx_memcpy(key->mac_key, buf + 32, 16);
+
+    ngx_memzero(buf, 48);
+}
+
+
+static ngx_ssl_session_ticket_key_t *
+ngx_ssl_session_ticket_key_lookup(ngx_connection_t *c, ngx_array_t *keys)
+{
+    u_char                        *p, *last;
+    size_t                         len;
+    ssize_t                        n;
+    ngx_uint_t                     i, type;
+    ngx_ssl_session_ticket_key_t  *key;
+    u_char                         buf[NGX_SSL_CLIENT_HELLO_PEEK];
+
+    /*
+     * PolarSSL decrypts tickets with the single key set in the context,
+     * so the key name is looked up in the ClientHello before PolarSSL
+     * reads it.  If the ClientHello has not fully arrived yet, the current
+     * key is used, and an old ticket just results in a full handshake.
+     */
+
+    key = keys->elts;
+
+    n = recv(c->fd, (char *) buf, NGX_SSL_CLIENT_HELLO_PEEK, MSG_PEEK);
+
+    /*
+     * record header (5), handshake header (4), client_version (2),
+     * random (32), session_id length (1)
+     */
+
+    if (n < 44 || buf[0] != 0x16 || buf[5] != 0x01) {
+        return key;
+    }
+
+    last = buf + n;
+    p = buf + 43;
+
+    /* session_id */
+
+    p += 1 + p[0];
+
+    /* cipher_suites */
+
+    if (last - p < 2) {
+        return key;
+    }
+
+    p += 2 + (p[0] << 8 | p[1]);
+
+    /* compression_methods */
+
+    if (last - p < 1) {
+        return key;
+    }
+
+    p += 1 + p[0];
+
+    /* extensions */
+
+    if (last - p < 2) {
+        return key;
+    }
+
+    p += 2;
+
+    while (last - p >= 4) {
+        type = p[0] << 8 | p[1];
+        len = p[2] << 8 | p[3];
+        p += 4;
+
+        if ((size_t) (last - p) < len) {
+            break;
+        }
+
+        if (type != 35 /* session_ticket */) {
+            p += len;
+            continue;
+        }
+
+        if (len < 16) {
+            break;
+        }
+
+        for (i = 0; i < keys->nelts; i++) {
+            if (ngx_memcmp(key[i].key_name, p, 16) == 0) {
+                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                               "ssl session ticket decrypt, key: %ui", i);
+                return &key[i];
+            }
+        }
+
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "ssl session ticket decrypt, key not found");
+        break;
+    }
+
+    return key;
 }
 
+#else
 
 ngx_int_t
-ngx_ssl_get_client_verify(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
 {
-    const x509_crt  *cert;
+    if (paths) {
+        ngx_log_error(NGX_LOG_WARN, ssl->log, 0,
+                      "\"ssl_session_ticket_keys\" ignored, not supported");
+    }
 
-    if (ssl_get_verify_result(c->ssl->connection) != 0) {
-        ngx_str_set(s, "FAILED");
-        return NGX_OK;
+    return NGX_OK;
+}
+
+#endif
+
+
+void
+ngx_ssl_remove_cached_session(ngx_ssl_t *ssl, ngx_ssl_session_t *sess)
+{
+    uint32_t                  hash;
+    ngx_ssl_sess_id_t        *sess_id;
+    ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shard_t  *shard;
+
+    if (ssl->cache_shm_zone == NULL || sess == NULL) {
+        return;
+    }
+
+    cache = ssl->cache_shm_zone->data;
+
+    hash = ngx_crc32_short(sess->id, sess->length);
+
+    shard = cache->shards[hash % cache->nshards];
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    sess_id = ngx_ssl_session_lookup(shard, hash, sess->id, sess->length);
+
+    if (sess_id) {
+        ngx_queue_remove(&sess_id->queue);
+
+        ngx_rbtree_delete(&shard->session_rbtree, &sess_id->node);
+
+        ngx_slab_free_locked(shard->shpool, sess_id);
+
+        shard->sessions--;
+    }
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+}
+
+
+static int
+ngx_polarssl_get_cache(void *ctx, ssl_session *session)
+{
+    ngx_ssl_t                *ssl;
+    uint32_t                  hash;
+    ngx_ssl_sess_id_t        *sess_id;
+    ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shard_t  *shard;
+
+    if (ctx == NULL) {
+        /* NGX_SSL_NONE_SCACHE: Every search is a cache miss */
+        return 1;
+    }
+
+    ssl = ctx;
+    cache = ssl->cache_shm_zone->data;
+
+    hash = ngx_crc32_short(session->id, session->length);
+
+    shard = cache->shards[hash % cache->nshards];
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    sess_id = ngx_ssl_session_lookup(shard, hash, session->id,
+                                     session->length);
+
+    if (sess_id == NULL) {
+        goto miss;
+    }
+
+    if (sess_id->expire <= ngx_time()) {
+
+        ngx_queue_remove(&sess_id->queue);
+
+        ngx_rbtree_delete(&shard->session_rbtree, &sess_id->node);
+
+        ngx_slab_free_locked(shard->shpool, sess_id);
+
+        shard->sessions--;
+
+        goto miss;
+    }
+
+    if (session->ciphersuite != sess_id->ciphersuite
+        || session->compression != sess_id->compression)
+    {
+        /* The ciphersuite/compression changed out from under us */
+        goto miss;
+    }
+
+    ngx_memcpy(session->master, sess_id->master, 48);
+
+    shard->hits++;
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+
+    return 0;
+
+miss:
+
+    shard->misses++;
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+
+    return 1;
+}
+
+
+static int
+ngx_polarssl_set_cache(void *ctx, const ssl_session *session)
+{
+    ngx_int_t                 rc;
+    ngx_ssl_t                *ssl;
+    uint32_t                  hash;
+    ngx_ssl_sess_id_t         sess;
+    ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shard_t  *shard;
+
+    if (ctx == NULL) {
+        /* NGX_SSL_NONE_SCACHE: Never cache any entries, but pretend to do so. */
+        return 0;
+    }
+
+    if (session->length > sizeof(sess.id)) {
+        return 1;
+    }
+
+    ssl = ctx;
+    cache = ssl->cache_shm_zone->data;
+
+    hash = ngx_crc32_short((u_char *) session->id, session->length);
+
+    /*
+     * Only the fields checked and restored by ngx_polarssl_get_cache()
+     * are stored; the peer certificate in particular is never cached.
+     */
+
+    sess.expire = ngx_time() + ssl->cache_ttl;
+    sess.ciphersuite = session->ciphersuite;
+    sess.compression = session->compression;
+    ngx_memcpy(sess.id, session->id, session->length);
+    ngx_memcpy(sess.master, session->master, 48);
+
+    sess.node.key = hash;
+    sess.node.data = (u_char) session->length;
+
+    shard = cache->shards[hash % cache->nshards];
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    rc = ngx_ssl_session_insert(shard, &sess);
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+
+    ngx_memzero(sess.master, 48);
+
+    return (rc == NGX_OK) ? 0 : 1;
+}
+
+
+static ngx_int_t
+ngx_ssl_session_insert(ngx_ssl_session_shard_t *shard, ngx_ssl_sess_id_t *sess)
+{
+    ngx_ssl_sess_id_t  *sess_id;
+
+    /* Prune some sessions from the cache to ensure the allocation succeds */
+
+    ngx_ssl_expire_sessions(shard, 1);
+
+    sess_id = ngx_slab_alloc_locked(shard->shpool, sizeof(ngx_ssl_sess_id_t));
+
+    if (sess_id == NULL) {
+
+        /* Prune the oldest non-expired session, and try again */
+
+        ngx_ssl_expire_sessions(shard, 0);
+
+        sess_id = ngx_slab_alloc_locked(shard->shpool,
+                                        sizeof(ngx_ssl_sess_id_t));
+        if (sess_id == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_memcpy(sess_id, sess, sizeof(ngx_ssl_sess_id_t));
+
+    ngx_queue_insert_head(&shard->expire_queue, &sess_id->queue);
+
+    ngx_rbtree_insert(&shard->session_rbtree, &sess_id->node);
+
+    shard->sessions++;
+
+    return NGX_OK;
+}
+
+
+static ngx_ssl_sess_id_t *
+ngx_ssl_session_lookup(ngx_ssl_session_shard_t *shard, uint32_t hash,
+    u_char *id, size_t len)
+{
+    ngx_int_t           rc;
+    ngx_rbtree_node_t  *node, *sentinel;
+    ngx_ssl_sess_id_t  *sess_id;
+
+    node = shard->session_rbtree.root;
+    sentinel = shard->session_rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        sess_id = (ngx_ssl_sess_id_t *) node;
+
+        rc = ngx_memn2cmp(id, sess_id->id, len, (size_t) node->data);
+
+        if (rc == 0) {
+            return sess_id;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_ssl_expire_sessions(ngx_ssl_session_shard_t *shard, ngx_uint_t n)
+{
+    time_t              now;
+    ngx_queue_t        *q;
+    ngx_ssl_sess_id_t  *sess_id;
+
+    now = ngx_time();
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&shard->expire_queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&shard->expire_queue);
+
+        sess_id = ngx_queue_data(q, ngx_ssl_sess_id_t, queue);
+
+        if (n++ != 0 && sess_id->expire > now) {
+            return;
+        }
+
+        if (sess_id->expire > now) {
+            shard->evictions++;
+        }
+
+        ngx_queue_remove(q);
+
+        ngx_rbtree_delete(&shard->session_rbtree, &sess_id->node);
+
+        ngx_slab_free_locked(shard->shpool, sess_id);
+
+        shard->sessions--;
+    }
+}
+
+
+static void
+ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t  **p;
+    ngx_ssl_sess_id_t   *sess_id, *sess_id_temp;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            sess_id = (ngx_ssl_sess_id_t *) node;
+            sess_id_temp = (ngx_ssl_sess_id_t *) temp;
+
+            p = (ngx_memn2cmp(sess_id->id, sess_id_temp->id,
+                              (size_t) node->data, (size_t) temp->data)
+                 < 0) ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+ngx_int_t
+ngx_ssl_session_cache_stat(ngx_ssl_t *ssl, ngx_ssl_cache_stat_t *stat)
+{
+    ngx_uint_t                i;
+    ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shard_t  *shard;
+
+    if (ssl->cache_shm_zone == NULL) {
+        return NGX_DECLINED;
+    }
+
+    ngx_memzero(stat, sizeof(ngx_ssl_cache_stat_t));
+
+    cache = ssl->cache_shm_zone->data;
+
+    for (i = 0; i < cache->nshards; i++) {
+        shard = cache->shards[i];
+
+        ngx_shmtx_lock(&shard->shpool->mutex);
+
+        stat->sessions += shard->sessions;
+        stat->hits += shard->hits;
+        stat->misses += shard->misses;
+        stat->evictions += shard->evictions;
+
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+    }
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_session_cache_file(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file,
+    ngx_str_t *key)
+{
+    u_char                 buf[32];
+    ssize_t                n;
+    ngx_file_t             kf;
+    ngx_uint_t             i;
+    ngx_file_info_t        fi;
+    ngx_polarssl_conf_t   *pcf;
+    ngx_ssl_cache_file_t  *cfe;
+
+    if (ngx_conf_full_name(cf->cycle, file, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    pcf = (ngx_polarssl_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                               ngx_polarssl_module);
+
+    /* the zone may be shared by several servers */
+
+    cfe = pcf->cache_files.elts;
+
+    for (i = 0; i < pcf->cache_files.nelts; i++) {
+
+        if (cfe[i].shm_zone != ssl->cache_shm_zone) {
+            continue;
+        }
+
+        if (cfe[i].file.len == file->len
+            && ngx_strncmp(cfe[i].file.data, file->data, file->len) == 0)
+        {
+            return NGX_OK;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "SSL session cache \"%V\" is already saved "
+                           "to \"%V\"", &ssl->cache_shm_zone->shm.name,
+                           &cfe[i].file);
+        return NGX_ERROR;
+    }
+
+    if (ngx_conf_full_name(cf->cycle, key, 1) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&kf, sizeof(ngx_file_t));
+    kf.name = *key;
+    kf.log = cf->log;
+
+    kf.fd = ngx_open_file(kf.name.data, NGX_FILE_RDONLY, 0, 0);
+    if (kf.fd == NGX_INVALID_FILE) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_open_file_n " \"%V\" failed", &kf.name);
+        return NGX_ERROR;
+    }
+
+    if (ngx_fd_info(kf.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_CRIT, cf, ngx_errno,
+                           ngx_fd_info_n " \"%V\" failed", &kf.name);
+        goto failed;
+    }
+
+    if (ngx_file_size(&fi) != 32) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must be 32 bytes", &kf.name);
+        goto failed;
+    }
+
+    n = ngx_read_file(&kf, buf, 32, 0);
+
+    if (n == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_CRIT, cf, ngx_errno,
+                           ngx_read_file_n " \"%V\" failed", &kf.name);
+        goto failed;
+    }
+
+    if (n != 32) {
+        ngx_conf_log_error(NGX_LOG_CRIT, cf, 0,
+                           ngx_read_file_n " \"%V\" returned only "
+                           "%z bytes instead of 32", &kf.name, n);
+        goto failed;
+    }
+
+    cfe = ngx_array_push(&pcf->cache_files);
+    if (cfe == NULL) {
+        goto failed;
+    }
+
+    cfe->shm_zone = ssl->cache_shm_zone;
+    cfe->file = *file;
+    ngx_memcpy(cfe->key, buf, 32);
+
+    ngx_memzero(buf, 32);
+
+    if (ngx_close_file(kf.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%V\" failed", &kf.name);
+    }
+
+    return NGX_OK;
+
+failed:
+
+    ngx_memzero(buf, 32);
+
+    if (ngx_close_file(kf.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%V\" failed", &kf.name);
+    }
+
+    return NGX_ERROR;
+}
+
+
+void
+ngx_ssl_session_cache_save(ngx_cycle_t *cycle)
+{
+    ngx_uint_t             i;
+    ngx_polarssl_conf_t   *pcf;
+    ngx_ssl_cache_file_t  *cfe;
+
+    pcf = (ngx_polarssl_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                               ngx_polarssl_module);
+    if (pcf == NULL) {
+        return;
+    }
+
+    cfe = pcf->cache_files.elts;
+
+    for (i = 0; i < pcf->cache_files.nelts; i++) {
+        (void) ngx_polarssl_session_cache_save(cycle, &cfe[i]);
+    }
+}
+
+
+/*
+ * The file is the magic, the GCM IV and tag, and the sessions encrypted
+ * with AES-256-GCM, the zone name is authenticated as well.  A session
+ * is stored as the expiry time (8 bytes), ciphersuite (2), compression
+ * (1), id length (1), id (32) and master secret (48), the numbers are
+ * in network byte order, so the sessions are sorted by memcmp().
+ */
+
+static ngx_int_t
+ngx_polarssl_session_cache_save(ngx_cycle_t *cycle, ngx_ssl_cache_file_t *cfe)
+{
+    u_char                   *buf, *p, *last, *name;
+    size_t                    size;
+    time_t                    now;
+    uint64_t                  expire;
+    ngx_fd_t                  fd;
+    ngx_uint_t                i, j, n;
+    ngx_queue_t              *q;
+    gcm_context               gcm;
+    ngx_ssl_sess_id_t        *sess_id;
+    ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shard_t  *shard;
+
+    cache = cfe->shm_zone->data;
+
+    if (cache == NULL) {
+        return NGX_OK;
+    }
+
+    now = ngx_time();
+
+    /* workers may still add sessions while the binary is changed */
+
+    n = 0;
+
+    for (i = 0; i < cache->nshards; i++) {
+        n += cache->shards[i]->sessions;
+    }
+
+    size = NGX_SSL_CACHE_FILE_HEADER + n * NGX_SSL_CACHE_FILE_RECORD;
+
+    buf = ngx_alloc(size, cycle->log);
+    if (buf == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = buf + NGX_SSL_CACHE_FILE_HEADER;
+    last = buf + size;
+
+    for (i = 0; i < cache->nshards; i++) {
+        shard = cache->shards[i];
+
+        /*
+         * the master must not hang on a shard left locked by a worker,
+         * so it waits for about a second and then skips the shard
+         */
+
+        for (j = 0; !ngx_shmtx_trylock(&shard->shpool->mutex); j++) {
+
+            if (j == 100) {
+                break;
+            }
+
+            ngx_msleep(10);
+        }
+
+        if (j == 100) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                          "shard %ui of SSL session cache \"%V\" is locked, "
+                          "its sessions are not saved",
+                          i, &cfe->shm_zone->shm.name);
+            continue;
+        }
+
+        for (q = ngx_queue_head(&shard->expire_queue);
+             q != ngx_queue_sentinel(&shard->expire_queue) && p < last;
+             q = ngx_queue_next(q))
+        {
+            sess_id = ngx_queue_data(q, ngx_ssl_sess_id_t, queue);
+
+            if (sess_id->expire <= now) {
+                continue;
+            }
+
+            expire = (uint64_t) sess_id->expire;
+
+            for (j = 0; j < 8; j++) {
+                p[j] = (u_char) (expire >> (56 - 8 * j));
+            }
+
+            p[8] = (u_char) (sess_id->ciphersuite >> 8);
+            p[9] = (u_char) sess_id->ciphersuite;
+            p[10] = (u_char) sess_id->compression;
+            p[11] = (u_char) sess_id->node.data;
+
+            ngx_memcpy(p + 12, sess_id->id, 32);
+            ngx_memcpy(p + 44, sess_id->master, 48);
+
+            p += NGX_SSL_CACHE_FILE_RECORD;
+        }
+
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+    }
+
+    size = p - buf;
+    n = (size - NGX_SSL_CACHE_FILE_HEADER) / NGX_SSL_CACHE_FILE_RECORD;
+
+    /* the oldest go first, so the newest end up at the queue heads */
+
+    ngx_qsort(buf + NGX_SSL_CACHE_FILE_HEADER, n, NGX_SSL_CACHE_FILE_RECORD,
+              ngx_polarssl_session_cmp);
+
+    ngx_memcpy(buf, NGX_SSL_CACHE_FILE_MAGIC, 8);
+
+    if (ctr_drbg_random(&ngx_ctr_drbg, buf + 8, 12) != 0
+        || gcm_init(&gcm, POLARSSL_CIPHER_ID_AES, cfe->key, 256) != 0)
+    {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                      "cannot encrypt SSL session cache \"%V\"",
+                      &cfe->shm_zone->shm.name);
+        goto failed;
+    }
+
+    (void) gcm_crypt_and_tag(&gcm, GCM_ENCRYPT,
+                             size - NGX_SSL_CACHE_FILE_HEADER,
+                             buf + 8, 12,
+                             cfe->shm_zone->shm.name.data,
+                             cfe->shm_zone->shm.name.len,
+                             buf + NGX_SSL_CACHE_FILE_HEADER,
+                             buf + NGX_SSL_CACHE_FILE_HEADER,
+                             16, buf + 20);
+
+    gcm_free(&gcm);
+
+    /* the file is replaced at once, a failure leaves the previous one */
+
+    name = ngx_pnalloc(cycle->pool, cfe->file.len + sizeof(".tmp"));
+    if (name == NULL) {
+        goto failed;
+    }
+
+    ngx_sprintf(name, "%V.tmp%Z", &cfe->file);
+
+    fd = ngx_open_file(name, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                       NGX_FILE_OWNER_ACCESS);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", name);
+        goto failed;
+    }
+
+    if (ngx_write_fd(fd, buf, size) != (ssize_t) size) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      ngx_write_fd_n " to \"%s\" failed", name);
+
+        (void) ngx_close_file(fd);
+        (void) ngx_delete_file(name);
+        goto failed;
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+
+    if (ngx_rename_file(name, cfe->file.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%V\" failed",
+                      name, &cfe->file);
+
+        (void) ngx_delete_file(name);
+        goto failed;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                  "%ui sessions of SSL session cache \"%V\" saved "
+                  "to \"%V\"", n, &cfe->shm_zone->shm.name, &cfe->file);
+
+    ngx_memzero(buf, size);
+    ngx_free(buf);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_memzero(buf, size);
+    ngx_free(buf);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_polarssl_session_cache_load(ngx_cycle_t *cycle, ngx_ssl_cache_file_t *cfe)
+{
+    u_char                   *buf, *p, *last;
+    size_t                    size;
+    time_t                    now;
+    ssize_t                   n;
+    uint32_t                  hash;
+    uint64_t                  expire;
+    ngx_int_t                 rc;
+    ngx_uint_t                i, loaded;
+    ngx_file_t                file;
+    gcm_context               gcm;
+    ngx_file_info_t           fi;
+    ngx_ssl_sess_id_t         sess;
+    ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shard_t  *shard;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+    file.name = cfe->file;
+    file.log = cycle->log;
+
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDONLY, 0, 0);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        if (ngx_errno != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, cycle->log, ngx_errno,
+                          ngx_open_file_n " \"%V\" failed", &file.name);
+        }
+
+        return NGX_ERROR;
+    }
+
+    buf = NULL;
+    size = 0;
+    rc = NGX_ERROR;
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, cycle->log, ngx_errno,
+                      ngx_fd_info_n " \"%V\" failed", &file.name);
+        goto done;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    if (size < NGX_SSL_CACHE_FILE_HEADER
+        || size > NGX_SSL_CACHE_FILE_HEADER + cfe->shm_zone->shm.size
+        || (size - NGX_SSL_CACHE_FILE_HEADER) % NGX_SSL_CACHE_FILE_RECORD)
+    {
+        ngx_log_error(NGX_LOG_ERR, cycle->log, 0,
+                      "invalid SSL session cache file \"%V\"", &file.name);
+        goto done;
+    }
+
+    buf = ngx_alloc(size, cycle->log);
+    if (buf == NULL) {
+        goto done;
+    }
+
+    n = ngx_read_file(&file, buf, size, 0);
+
+    if (n == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, cycle->log, ngx_errno,
+                      ngx_read_file_n " \"%V\" failed", &file.name);
+        goto done;
+    }
+
+    if ((size_t) n != size
+        || ngx_memcmp(buf, NGX_SSL_CACHE_FILE_MAGIC, 8) != 0)
+    {
+        ngx_log_error(NGX_LOG_ERR, cycle->log, 0,
+                      "invalid SSL session cache file \"%V\"", &file.name);
+        goto done;
+    }
+
+    if (gcm_init(&gcm, POLARSSL_CIPHER_ID_AES, cfe->key, 256) != 0) {
+        goto done;
+    }
+
+    if (gcm_auth_decrypt(&gcm, size - NGX_SSL_CACHE_FILE_HEADER,
+                         buf + 8, 12,
+                         cfe->shm_zone->shm.name.data,
+                         cfe->shm_zone->shm.name.len,
+                         buf + 20, 16,
+                         buf + NGX_SSL_CACHE_FILE_HEADER,
+                         buf + NGX_SSL_CACHE_FILE_HEADER)
+        != 0)
+    {
+        gcm_free(&gcm);
+
+        ngx_log_error(NGX_LOG_ERR, cycle->log, 0,
+                      "SSL session cache file \"%V\" cannot be decrypted, "
+                      "ignored", &file.name);
+        goto done;
+    }
+
+    gcm_free(&gcm);
+
+    cache = cfe->shm_zone->data;
+    now = ngx_time();
+    loaded = 0;
+
+    last = buf + size;
+
+    for (p = buf + NGX_SSL_CACHE_FILE_HEADER;
+         p < last;
+         p += NGX_SSL_CACHE_FILE_RECORD)
+    {
+        expire = 0;
+
+        for (i = 0; i < 8; i++) {
+            expire = (expire << 8) | p[i];
+        }
+
+        if ((time_t) expire <= now || p[11] > 32) {
+            continue;
+        }
+
+        sess.expire = (time_t) expire;
+        sess.ciphersuite = (p[8] << 8) | p[9];
+        sess.compression = p[10];
+        ngx_memcpy(sess.id, p + 12, 32);
+        ngx_memcpy(sess.master, p + 44, 48);
+
+        hash = ngx_crc32_short(sess.id, p[11]);
+
+        sess.node.key = hash;
+        sess.node.data = p[11];
+
+        shard = cache->shards[hash % cache->nshards];
+
+        ngx_shmtx_lock(&shard->shpool->mutex);
+
+        if (ngx_ssl_session_insert(shard, &sess) == NGX_OK) {
+            loaded++;
+        }
+
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+    }
+
+    ngx_memzero(sess.master, 48);
+
+    ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                  "%ui sessions of SSL session cache \"%V\" loaded "
+                  "from \"%V\"", loaded, &cfe->shm_zone->shm.name,
+                  &file.name);
+
+    rc = NGX_OK;
+
+done:
+
+    if (buf) {
+        ngx_memzero(buf, size);
+        ngx_free(buf);
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%V\" failed", &file.name);
+    }
+
+    return rc;
+}
+
+
+static int ngx_libc_cdecl
+ngx_polarssl_session_cmp(const void *one, const void *two)
+{
+    return ngx_memcmp(one, two, 8);
+}
+
+
+ngx_ssl_session_t *
+ngx_ssl_get_session(ngx_connection_t *c)
+{
+    int                 sslerr;
+    ngx_ssl_session_t  *session;
+
+    /*
+     * PolarSSL sessions are not reference counted, so the caller gets
+     * a private deep copy that must be released by ngx_ssl_free_session()
+     */
+
+    session = ngx_alloc(sizeof(ngx_ssl_session_t), c->log);
+    if (session == NULL) {
+        return NULL;
+    }
+
+    ssl_session_init(session);
+
+    sslerr = ssl_get_session(c->ssl->connection, session);
+    if (sslerr != 0) {
+        ngx_polarssl_error(NGX_LOG_ALERT, c->log, 0, sslerr,
+                           "ssl_get_session() failed");
+        ngx_ssl_free_session(session);
+        return NULL;
+    }
+
+    return session;
+}
+
+
+ngx_ssl_session_t *
+ngx_ssl_peek_session(ngx_connection_t *c)
+{
+    return c->ssl->connection->session;
+}
+
+
+void
+ngx_ssl_free_session(ngx_ssl_session_t *session)
+{
+    ssl_session_free(session);
+    ngx_free(session);
+}
+
+
+ngx_int_t
+ngx_ssl_have_peer_cert(ngx_connection_t *c)
+{
+    if (ssl_get_peer_cert(c->ssl->connection) != NULL) {
+        return NGX_OK;
+    }
+
+    return NGX_ERROR;
+}
+
+
+ngx_int_t
+ngx_ssl_verify_result(ngx_connection_t *c, long *rc, const char **errstr)
+{
+    int  sslerr;
+
+    sslerr = ssl_get_verify_result(c->ssl->connection);
+
+    if (sslerr != 0) {
+        *rc = sslerr;
+        *errstr = ngx_polarssl_verify_error_str(sslerr);
+
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_get_protocol(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+{
+    s->data = (u_char *) ssl_get_version(c->ssl->connection);
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_get_cipher_name(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+{
+    s->data = (u_char *) ssl_get_ciphersuite(c->ssl->connection);
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_get_session_id(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+{
+    ssl_session  *session = c->ssl->connection->session;
+
+    /*
+     * ngx_event_openssl's implementation of this returns a hexdump of
+     * the ASN.1 encoded SSL session object.  Our implementation just
+     * returns a hexdump of the session id, because this routine is not
+     * named ngx_ssl_get_entire_session_object.
+     */
+
+    s->len = session->length * 2;
+    s->data = ngx_pnalloc(pool, s->len);
+    if (s->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_hex_dump(s->data, session->id, session->length);
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_get_session_reused(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+{
+    if (c->ssl->reused) {
+        ngx_str_set(s, "r");
+
+    } else {
+        ngx_str_set(s, ".");
+    }
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_get_handshake_time(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s)
+{
+    ngx_uint_t  usec;
+
+    /* milliseconds spent in the handshake by the worker and the threads */
+
+    s->data = ngx_pnalloc(pool, NGX_INT_T_LEN + 4);
+    if (s->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    usec = c->ssl->handshake_time;
+
+    s->len = ngx_sprintf(s->data, "%ui.%03ui", usec / 1000, usec % 1000)
+             - s->data;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_get_raw_certificate(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+{
+    static const int            header_len = 29;
+    static const int            footer_len = 25;
+    static const unsigned char  pem_header[] = { "-----BEGIN CERTIFICATE-----\r\n" };
+    static const unsigned char  pem_footer[] = { "-----END CERTIFICATE-----" };
+    size_t                      len = 0, i;
+    const x509_crt            *cert;
+    unsigned char              *p = NULL;
+
+    /*
+     * PolarSSL does not have a built in routine to write certificates
+     * in PEM format.  Thankfully it's relatively easy to do since it
+     * keeps a copy of the DER format certificate around.
+     */
+
+    cert = ssl_get_peer_cert(c->ssl->connection);
+    if (cert == NULL || cert->raw.len == 0) {
+        return NGX_OK;
+    }
+
+    /* Determine how much buffer space is required */
+
+    base64_encode(p, &len, cert->raw.p, cert->raw.len);
+    len += (len / 64 + 1) * 2;
+    len += header_len;
+    len += footer_len;
+
+    p = s->data = ngx_pnalloc(pool, len);
+    if (s->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* Append the header */
+
+    ngx_memcpy(p, pem_header, header_len);
+    p += header_len;
+
+    /* Base64 encode the cert, inserting newlines every 64 characters. */
+
+    for (i = 0; i < cert->raw.len; /* i incremented in body */) {
+        size_t to_encode = (cert->raw.len - i > 48) ? 48 : cert->raw.len - i;
+        size_t dlen = len - (p - s->data);
+
+        base64_encode(p, &dlen, cert->raw.p + i, to_encode);
+
+        p += dlen;
+        *p++ = '\r';
+        *p++ = '\n';
+
+        i+= to_encode;
+    }
+
+    /* Append the footer */
+
+    ngx_memcpy(p, pem_footer, footer_len);
+    p += footer_len;
+    *p = '\0';
+
+    s->len = ngx_strlen(s->data);
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_get_certificate(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+{
+
+    /*
+     * As far as I can tell, both of ngx_ssl_get_certificate and
+     * ngx_ssl_get_raw_certificate just return the peer certificate
+     * in PEM format, with ngx_ssl_get_certificate messing with
+     * whitespace.
+     *
+     * Since our PEM generator doesn't prefix any lines with whitespace
+     * at all, the functions can just return identical output.
+     */
+
+    return ngx_ssl_get_raw_certificate(c, pool, s);
+}
+
+
+ngx_int_t
+ngx_ssl_get_subject_dn(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+{
+    const x509_crt  *cert;
+    int               len;
+
+    if (c->ssl->verify) {
+        *s = c->ssl->verify->subject;
+        return NGX_OK;
+    }
+
+    cert = ssl_get_peer_cert(c->ssl->connection);
+    if (cert == NULL) {
+        return NGX_OK;
+    }
+
+    s->data = ngx_pnalloc(pool, POLARSSL_DN_MAX_LENGTH);
+    if (s->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    len = x509_dn_gets((char *) s->data, POLARSSL_DN_MAX_LENGTH - 1,
+                            &cert->subject);
+    if (len < 0) {
+        return NGX_ERROR;
+    }
+
+    s->len = len;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_get_issuer_dn(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+{
+    const x509_crt  *cert;
+    int               len;
+
+    if (c->ssl->verify) {
+        *s = c->ssl->verify->issuer;
+        return NGX_OK;
+    }
+
+    cert = ssl_get_peer_cert(c->ssl->connection);
+    if (cert == NULL) {
+        return NGX_OK;
+    }
+
+    s->data = ngx_pnalloc(pool, POLARSSL_DN_MAX_LENGTH);
+    if (s->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    len = x509_dn_gets((char *) s->data, POLARSSL_DN_MAX_LENGTH - 1,
+                             &cert->issuer);
+    if (len < 0) {
+        return NGX_ERROR;
+    }
+
+    s->len = len;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_get_serial_number(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+{
+    const x509_crt  *cert;
+    int               len;
+
+    if (c->ssl->verify) {
+        *s = c->ssl->verify->serial;
+        return NGX_OK;
+    }
+
+    cert = ssl_get_peer_cert(c->ssl->connection);
+    if (cert == NULL) {
+        return NGX_OK;
+    }
+
+    len = cert->serial.len * 3 + 1;
+    s->data = ngx_palloc(pool, len);
+    if (s->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    len = x509_serial_gets((char *) s->data, len - 1, &cert->serial);
+    if (len < 0) {
+        return NGX_ERROR;
+    }
+
+    s->len = len;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_get_client_verify(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+{
+    const x509_crt  *cert;
+
+    if (ssl_get_verify_result(c->ssl->connection) != 0) {
+        ngx_str_set(s, "FAILED");
+        return NGX_OK;
+    }
+
+    cert = ssl_get_peer_cert(c->ssl->connection);
+
+    if (cert) {
+        ngx_str_set(s, "SUCCESS");
+    } else {
+        ngx_str_set(s, "NONE");
+    }
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c,
+    ngx_uint_t flags)
+{
+    ngx_ssl_connection_t     *sc;
+    ngx_ssl_conn_t           *ssl_ctx;
+    int                       sslerr;
+
+    sc = ngx_pcalloc(c->pool, sizeof(ngx_ssl_connection_t));
+    if (sc == NULL) {
+        return NGX_ERROR;
+    }
+
+    sc->buffer = ((flags & NGX_SSL_BUFFER) != 0);
+    sc->buffer_size = ssl->buffer_size;
+
+    sc->dyn_rec = ssl->dyn_rec;
+    sc->ktls = ssl->ktls;
+    sc->stat = ssl->stat;
+
+    /* Allocate the PolarSSL context */
+
+#if (NGX_THREAD_POOL)
+
+    if (ssl->thread_pool && !(flags & NGX_SSL_CLIENT)) {
+        sc->async = ngx_polarssl_async_create(c, ssl->thread_pool);
+        if (sc->async == NULL) {
+            return NGX_ERROR;
+        }
+
+        ssl_ctx = &sc->async->ssl_conn;
+
+    } else {
+        ssl_ctx = ngx_pcalloc(c->pool, sizeof(ngx_ssl_conn_t));
+    }
+
+#else
+
+    ssl_ctx = ngx_pcalloc(c->pool, sizeof(ngx_ssl_conn_t));
+
+#endif
+
+    if (ssl_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * Initialize this PolarSSL context
+     *
+     * Note: We also setup the options traditionally set in ngx_ssl_create
+     * here since each ssl_ctx is unique to each fd.
+     */
+
+    sslerr = ssl_init(ssl_ctx);
+    if (sslerr != 0) {
+        ngx_polarssl_error(NGX_LOG_ALERT, ssl->log, 0, sslerr,
+                           "ssl_init failed");
+        return NGX_ERROR;
+    }
+
+    if (flags & NGX_SSL_CLIENT) {
+        ssl_set_endpoint(ssl_ctx, SSL_IS_CLIENT);
+    } else {
+        ssl_set_endpoint(ssl_ctx, SSL_IS_SERVER);
+    }
+
+    if (ngx_ssl_use_certificates(ssl_ctx, ssl) != NGX_OK) {
+        ngx_polarssl_free(ssl_ctx);
+        return NGX_ERROR;
+    }
+
+    sc->connection = ssl_ctx;
+
+    if (ssl->have_ca_cert) {
+        ngx_ssl_use_ca_chain(sc, ssl);
+
+    } else {
+        ssl_set_authmode(ssl_ctx, SSL_VERIFY_NONE);
+    }
+
+    ssl_set_min_version(ssl_ctx, SSL_MAJOR_VERSION_3, ssl->minor_min);
+    ssl_set_max_version(ssl_ctx, SSL_MAJOR_VERSION_3, ssl->minor_max);
+
+    ssl_set_renegotiation(ssl_ctx, SSL_RENEGOTIATION_ENABLED);
+    ssl_legacy_renegotiation(ssl_ctx, SSL_LEGACY_NO_RENEGOTIATION);
+
+    ssl_set_rng(ssl_ctx, ctr_drbg_random, &ngx_ctr_drbg);
+    ssl_set_bio(ssl_ctx, ngx_polarssl_bio_recv, c, ngx_polarssl_bio_send, c);
+
+    ssl_set_dh_param_ctx(ssl_ctx, &ssl->dhm_ctx);
+    ssl_set_ciphersuites(ssl_ctx, ssl->ciphersuites);
+
+#if defined(POLARSSL_ECDH_C) && defined(POLARSSL_SSL_SET_CURVES)
+
+    /*
+     * Without ssl_set_curves() PolarSSL offers every curve it was built
+     * with for ECDHE, which still works but ignores "ssl_ecdh_curve".
+     */
+
+    if (ssl->curves[0] != POLARSSL_ECP_DP_NONE) {
+        ssl_set_curves(ssl_ctx, ssl->curves);
+    }
+
+#endif
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+
+    if (!(flags & NGX_SSL_CLIENT) && ssl->ticket_keys) {
+
+        /*
+         * The keys are shared by all connections and owned by ngx_ssl_t,
+         * setting them beforehand prevents ssl_set_session_tickets()
+         * from generating a key per connection.
+         */
+
+        ssl_ctx->ticket_keys = ssl->ticket_keys->elts;
+
+        sslerr = ssl_set_session_tickets(ssl_ctx,
+                                         SSL_SESSION_TICKETS_ENABLED);
+        if (sslerr != 0) {
+            ngx_polarssl_error(NGX_LOG_ALERT, ssl->log, 0, sslerr,
+                               "ssl_set_session_tickets() failed");
+            ngx_polarssl_free(ssl_ctx);
+            return NGX_ERROR;
+        }
+
+        ssl_set_session_ticket_lifetime(ssl_ctx, (int) ssl->cache_ttl);
+
+        if (ssl->ticket_keys->nelts > 1) {
+            sc->ticket_keys = ssl->ticket_keys;
+        }
+    }
+
+#endif
+
+    if (ssl->builtin_session_cache == NGX_SSL_NONE_SCACHE) {
+        ssl_set_session_cache(ssl_ctx,
+                ngx_polarssl_get_cache, NULL,
+                ngx_polarssl_set_cache, NULL);
+    }
+
+    if (ssl->cache_shm_zone) {
+        ssl_set_session_cache(ssl_ctx,
+                ngx_polarssl_get_cache, ssl,
+                ngx_polarssl_set_cache, ssl);
+    }
+
+    if (ssl->sni_fn) {
+        ssl_set_sni(ssl_ctx, ssl->sni_fn, c);
+    }
+
+    /* All done, the connection is good to go now */
+
+    c->ssl = sc;
+    
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_handshake(ngx_connection_t *c)
+{
+    int         sslerr;
+    ngx_uint_t  start;
+
+    start = ngx_polarssl_usec();
+
+    sslerr = ngx_polarssl_handshake(c);
+
+    c->ssl->handshake_time += ngx_polarssl_usec() - start;
+
+    if (sslerr == 0) {
+
+#if (NGX_STAT_STUB)
+        ngx_polarssl_handshake_stat(c, sslerr);
+#endif
+
+        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        c->ssl->handshaked = 1;
+
+        if (c->ssl->verify_hash) {
+            ngx_polarssl_verify_insert(c);
+        }
+
+        c->recv = ngx_ssl_recv;
+        c->send = ngx_ssl_write;
+        c->recv_chain = ngx_ssl_recv_chain;
+        c->send_chain = ngx_ssl_send_chain;
+
+#if (NGX_HAVE_KTLS)
+        if (c->ssl->ktls) {
+            ngx_polarssl_ktls(c);
+        }
+#endif
+
+        /*
+         * Versions of PolarSSL this is developed against are not vulnerable
+         * to CVE-2009-3555, leave renegotiaton as is.
+         */
+
+        return NGX_OK;
+    }
+
+    if (sslerr == POLARSSL_ERR_NET_WANT_READ) {
+        c->read->ready = 0;
+        c->read->handler = ngx_ssl_handshake_handler;
+        c->write->handler = ngx_ssl_handshake_handler;
+
+        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        return NGX_AGAIN;
+    }
+
+    if (sslerr == POLARSSL_ERR_NET_WANT_WRITE) {
+        c->write->ready = 0;
+        c->read->handler = ngx_ssl_handshake_handler;
+        c->write->handler = ngx_ssl_handshake_handler;
+
+        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        return NGX_AGAIN;
+    }
+
+#if (NGX_THREAD_POOL)
+
+    if (sslerr == NGX_SSL_ASYNC) {
+        c->read->handler = ngx_ssl_handshake_handler;
+        c->write->handler = ngx_ssl_handshake_handler;
+
+        /*
+         * the handshake is resumed by the task completion handler,
+         * level-triggered events would only spin until then
+         */
+
+        if (ngx_event_flags & NGX_USE_LEVEL_EVENT) {
+
+            if (c->read->active
+                && ngx_del_event(c->read, NGX_READ_EVENT, 0) != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            if (c->write->active
+                && ngx_del_event(c->write, NGX_WRITE_EVENT, 0) != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+
+        return NGX_AGAIN;
+    }
+
+#endif
+
+#if (NGX_STAT_STUB)
+    ngx_polarssl_handshake_stat(c, sslerr);
+#endif
+
+    c->ssl->no_send_shutdown = 1;
+    c->read->eof = 1;
+
+    if (sslerr == POLARSSL_ERR_SSL_CONN_EOF) {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "peer closed connection in SSL handshake");
+        return NGX_ERROR;
+    }
+
+    c->read->error = 1;
+
+    ngx_polarssl_error(NGX_LOG_ERR, c->log, 0, sslerr, "ssl_handshake() failed");
+
+    return NGX_ERROR;
+}
+
+
+static int
+ngx_polarssl_handshake(ngx_connection_t *c)
+{
+    int              sslerr;
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+
+    ngx_array_t     *keys;
+    ngx_ssl_conn_t  *ssl_conn;
+
+    ssl_conn = c->ssl->connection;
+    keys = c->ssl->ticket_keys;
+
+    if (keys == NULL || ssl_conn->state > SSL_CLIENT_HELLO) {
+        goto handshake;
+    }
+
+    if (ssl_conn->state == SSL_HELLO_REQUEST) {
+        ssl_conn->ticket_keys = ngx_ssl_session_ticket_key_lookup(c, keys);
+    }
+
+    /*
+     * The key found may be a decrypt-only one, so the ClientHello is
+     * processed on its own, and the current key is restored before
+     * a new ticket is issued.
+     */
+
+    while (ssl_conn->state <= SSL_CLIENT_HELLO) {
+        sslerr = ssl_handshake_step(ssl_conn);
+
+        if (sslerr != 0) {
+            return sslerr;
+        }
+    }
+
+    ssl_conn->ticket_keys = keys->elts;
+    c->ssl->ticket_keys = NULL;
+
+handshake:
+
+#endif
+
+#if (NGX_THREAD_POOL)
+
+    if (c->ssl->async) {
+        return ngx_polarssl_async_handshake(c);
+    }
+
+#endif
+
+    while (c->ssl->connection->state != SSL_HANDSHAKE_OVER) {
+
+        sslerr = ngx_polarssl_handshake_step(c);
+
+        if (sslerr != 0) {
+            return sslerr;
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+ngx_polarssl_handshake_step(ngx_connection_t *c)
+{
+    ngx_ssl_conn_t  *ssl_conn;
+
+    ssl_conn = c->ssl->connection;
+
+    /*
+     * ssl_handshake() frees the handshake parameters at the end, so
+     * whether the session was resumed is saved before the last step.
+     * A session ticket is accepted while the ClientHello is parsed,
+     * a session from the cache is found while the ServerHello is made.
+     */
+
+    if (ssl_conn->handshake && ssl_conn->handshake->resume) {
+
+        if (ssl_conn->state == SSL_SERVER_HELLO
+            && ssl_conn->endpoint == SSL_IS_SERVER)
+        {
+            c->ssl->reused_ticket = 1;
+        }
+
+        if (ssl_conn->state == SSL_HANDSHAKE_WRAPUP) {
+            c->ssl->reused = 1;
+        }
+    }
+
+    if (ssl_conn->state == SSL_CLIENT_CERTIFICATE && c->ssl->verify_cache) {
+        return ngx_polarssl_verify_step(c);
+    }
+
+    return ssl_handshake_step(ssl_conn);
+}
+
+
+/*
+ * reads a whole plaintext record ahead of PolarSSL; the record length
+ * comes from the peer and is checked against the input buffer as
+ * ssl_read_record() does, since not all 1.3 releases of ssl_fetch_input()
+ * check it themselves
+ */
+
+static int
+ngx_polarssl_fetch_record(ngx_ssl_conn_t *ssl_conn, size_t *len)
+{
+    int     sslerr;
+    size_t  n;
+
+    sslerr = ssl_fetch_input(ssl_conn, 5);
+    if (sslerr != 0) {
+        return sslerr;
+    }
+
+    n = (ssl_conn->in_hdr[3] << 8) | ssl_conn->in_hdr[4];
+
+    /* in_ctr is the start of the input buffer */
+
+    if (n > SSL_BUFFER_LEN - (size_t) (ssl_conn->in_hdr - ssl_conn->in_ctr)
+            - 5)
+    {
+        return POLARSSL_ERR_SSL_INVALID_RECORD;
+    }
+
+    sslerr = ssl_fetch_input(ssl_conn, 5 + n);
+    if (sslerr != 0) {
+        return sslerr;
+    }
+
+    *len = n;
+
+    return 0;
+}
+
+
+static int
+ngx_polarssl_verify_step(ngx_connection_t *c)
+{
+    int              sslerr, result;
+    size_t           len, n;
+    u_char          *p, hash[32];
+    x509_crt         none, *ca_chain, *crt;
+    x509_crl        *ca_crl;
+    ngx_int_t        rc;
+    ngx_ssl_t       *ssl;
+    ssl_session     *session;
+    sha256_context   sha;
+    ngx_ssl_conn_t  *ssl_conn;
+
+    ssl = c->ssl->verify_cache;
+    ssl_conn = c->ssl->connection;
+
+    /*
+     * The Certificate message starts the client's flight and is read
+     * beforehand to find the chain in the cache.  A renegotiation
+     * comes encrypted and is left to PolarSSL.
+     */
+
+    if (ssl_conn->authmode == SSL_VERIFY_NONE
+        || ssl_conn->transform_in != NULL
+        || (ssl_conn->in_hslen != 0
+            && ssl_conn->in_hslen < ssl_conn->in_msglen))
+    {
+        return ssl_handshake_step(ssl_conn);
+    }
+
+    sslerr = ngx_polarssl_fetch_record(ssl_conn, &len);
+    if (sslerr != 0) {
+        return sslerr;
+    }
+
+    p = ssl_conn->in_hdr;
+
+    if (p[0] != SSL_MSG_HANDSHAKE || len < 7 || p[5] != SSL_HS_CERTIFICATE) {
+        return ssl_handshake_step(ssl_conn);
+    }
+
+    n = (p[9] << 16) | (p[10] << 8) | p[11];
+
+    if (n == 0 || n + 7 > len) {
+        return ssl_handshake_step(ssl_conn);
+    }
+
+    sha256_starts(&sha, 0);
+    sha256_update(&sha, ssl->verify_cache_ctx, 32);
+    sha256_update(&sha, p + 12, n);
+    sha256_finish(&sha, hash);
+
+    rc = ngx_polarssl_verify_lookup(c, hash, &result);
+
+    if (rc == NGX_ERROR) {
+        return POLARSSL_ERR_SSL_MALLOC_FAILED;
+    }
+
+    if (rc == NGX_DECLINED) {
+        c->ssl->verify_hash = ngx_pnalloc(c->pool, 32);
+        if (c->ssl->verify_hash == NULL) {
+            return POLARSSL_ERR_SSL_MALLOC_FAILED;
+        }
+
+        ngx_memcpy(c->ssl->verify_hash, hash, 32);
+
+        return ssl_handshake_step(ssl_conn);
+    }
+
+    /*
+     * PolarSSL cannot be told to skip the verification, so the chain
+     * is parsed with no CA certificates to check it against and the
+     * cached result is set instead of the one it fails with.  Only
+     * the validity periods of the chain are checked again: a result
+     * cached before an intermediate expired must not outlive it.
+     */
+
+    x509_crt_init(&none);
+
+    ca_chain = ssl_conn->ca_chain;
+    ca_crl = ssl_conn->ca_crl;
+
+    ssl_conn->ca_chain = &none;
+    ssl_conn->ca_crl = NULL;
+
+    sslerr = ssl_handshake_step(ssl_conn);
+
+    ssl_conn->ca_chain = ca_chain;
+    ssl_conn->ca_crl = ca_crl;
+
+    if (sslerr != 0) {
+        return sslerr;
+    }
+
+    session = ssl_conn->session_negotiate;
+
+    for (crt = session->peer_cert; crt; crt = crt->next) {
+
+        if (crt->version == 0) {
+            continue;
+        }
+
+        if (x509_time_expired(&crt->valid_to)) {
+            result |= BADCERT_EXPIRED;
+        }
+
+        if (x509_time_future(&crt->valid_from)) {
+            result |= BADCERT_FUTURE;
+        }
+    }
+
+    session->verify_result = result;
+
+    return 0;
+}
+
+
+static ngx_int_t
+ngx_polarssl_verify_lookup(ngx_connection_t *c, u_char *hash, int *result)
+{
+    u_char                  *p;
+    uint32_t                 key;
+    ngx_int_t                rc;
+    ngx_ssl_verify_t        *v;
+    ngx_rbtree_node_t       *node, *sentinel;
+    ngx_ssl_verify_node_t   *vn;
+    ngx_ssl_verify_cache_t  *cache;
+
+    cache = c->ssl->verify_cache->verify_cache_shm_zone->data;
+
+    ngx_memcpy(&key, hash, sizeof(uint32_t));
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    node = cache->rbtree.root;
+    sentinel = cache->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* key == node->key */
+
+        vn = (ngx_ssl_verify_node_t *) node;
+
+        rc = ngx_memcmp(hash, vn->hash, 32);
+
+        if (rc == 0) {
+            goto found;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return NGX_DECLINED;
+
+found:
+
+    if (vn->expire <= ngx_time()) {
+
+        ngx_queue_remove(&vn->queue);
+
+        ngx_rbtree_delete(&cache->rbtree, &vn->node);
+
+        ngx_slab_free_locked(cache->shpool, vn);
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        return NGX_DECLINED;
+    }
+
+    v = ngx_palloc(c->pool, sizeof(ngx_ssl_verify_t) + vn->subject_len
+                            + vn->issuer_len + vn->serial_len);
+    if (v == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_ERROR;
+    }
+
+    p = (u_char *) v + sizeof(ngx_ssl_verify_t);
+
+    v->subject.len = vn->subject_len;
+    v->subject.data = p;
+    p = ngx_cpymem(p, vn->data, vn->subject_len);
+
+    v->issuer.len = vn->issuer_len;
+    v->issuer.data = p;
+    p = ngx_cpymem(p, vn->data + vn->subject_len, vn->issuer_len);
+
+    v->serial.len = vn->serial_len;
+    v->serial.data = p;
+    ngx_memcpy(p, vn->data + vn->subject_len + vn->issuer_len,
+               vn->serial_len);
+
+    *result = vn->verify_result;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "ssl verify cache hit: %d", *result);
+
+    c->ssl->verify = v;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_polarssl_verify_insert(ngx_connection_t *c)
+{
+    size_t                   n;
+    u_char                  *p;
+    uint32_t                 key;
+    ngx_ssl_t               *ssl;
+    ngx_ssl_verify_t        *v;
+    ngx_ssl_verify_node_t   *vn;
+    ngx_ssl_verify_cache_t  *cache;
+
+    ssl = c->ssl->verify_cache;
+
+    p = c->ssl->verify_hash;
+    c->ssl->verify_hash = NULL;
+
+    if (ssl_get_peer_cert(c->ssl->connection) == NULL) {
+        return;
+    }
+
+    /* the strings are formatted once for both the variables and the cache */
+
+    v = ngx_palloc(c->pool, sizeof(ngx_ssl_verify_t));
+    if (v == NULL) {
+        return;
+    }
+
+    if (ngx_ssl_get_subject_dn(c, c->pool, &v->subject) != NGX_OK
+        || ngx_ssl_get_issuer_dn(c, c->pool, &v->issuer) != NGX_OK
+        || ngx_ssl_get_serial_number(c, c->pool, &v->serial) != NGX_OK)
+    {
+        return;
+    }
+
+    c->ssl->verify = v;
+
+    cache = ssl->verify_cache_shm_zone->data;
+
+    n = offsetof(ngx_ssl_verify_node_t, data)
+        + v->subject.len + v->issuer.len + v->serial.len;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    /* Prune some entries from the cache to ensure the allocation succeds */
+
+    ngx_ssl_expire_verified(cache, 1);
+
+    vn = ngx_slab_alloc_locked(cache->shpool, n);
+
+    if (vn == NULL) {
+
+        /* Prune the oldest non-expired entry, and try again */
+
+        ngx_ssl_expire_verified(cache, 0);
+
+        vn = ngx_slab_alloc_locked(cache->shpool, n);
+        if (vn == NULL) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return;
+        }
+    }
+
+    ngx_memcpy(&key, p, sizeof(uint32_t));
+
+    vn->node.key = key;
+    ngx_memcpy(vn->hash, p, 32);
+
+    vn->expire = ngx_time() + ssl->verify_cache_ttl;
+    vn->verify_result = ssl_get_verify_result(c->ssl->connection);
+
+    vn->subject_len = (u_short) v->subject.len;
+    vn->issuer_len = (u_short) v->issuer.len;
+    vn->serial_len = (u_short) v->serial.len;
+
+    p = ngx_cpymem(vn->data, v->subject.data, v->subject.len);
+    p = ngx_cpymem(p, v->issuer.data, v->issuer.len);
+    ngx_memcpy(p, v->serial.data, v->serial.len);
+
+    ngx_queue_insert_head(&cache->expire_queue, &vn->queue);
+
+    ngx_rbtree_insert(&cache->rbtree, &vn->node);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+
+static void
+ngx_ssl_expire_verified(ngx_ssl_verify_cache_t *cache, ngx_uint_t n)
+{
+    time_t                  now;
+    ngx_queue_t            *q;
+    ngx_ssl_verify_node_t  *vn;
+
+    now = ngx_time();
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&cache->expire_queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&cache->expire_queue);
+
+        vn = ngx_queue_data(q, ngx_ssl_verify_node_t, queue);
+
+        if (n++ != 0 && vn->expire > now) {
+            return;
+        }
+
+        ngx_queue_remove(q);
+
+        ngx_rbtree_delete(&cache->rbtree, &vn->node);
+
+        ngx_slab_free_locked(cache->shpool, vn);
+    }
+}
+
+
+static void
+ngx_ssl_verify_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t      **p;
+    ngx_ssl_verify_node_t   *vn, *vnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            vn = (ngx_ssl_verify_node_t *) node;
+            vnt = (ngx_ssl_verify_node_t *) temp;
+
+            p = (ngx_memcmp(vn->hash, vnt->hash, 32) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_uint_t
+ngx_polarssl_usec(void)
+{
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (ngx_uint_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+#if (NGX_STAT_STUB)
+
+static void
+ngx_polarssl_handshake_stat(ngx_connection_t *c, int sslerr)
+{
+    ngx_uint_t     usec, n;
+    ngx_atomic_t  *st;
+
+    if (c->ssl->connection->endpoint != SSL_IS_SERVER) {
+        return;
+    }
+
+    st = c->ssl->stat;
+
+    if (sslerr != 0) {
+        (void) ngx_atomic_fetch_add(&ngx_stat_ssl[NGX_SSL_STAT_FAILED], 1);
+
+        if (st) {
+            (void) ngx_atomic_fetch_add(&st[NGX_SSL_STAT_FAILED], 1);
+        }
+
+        n = (sslerr < 0) ? ((ngx_uint_t) -sslerr >> 7) : 0;
+
+        if (n >= NGX_SSL_STAT_CODES) {
+            n = 0;
+        }
+
+        (void) ngx_atomic_fetch_add(&ngx_stat_ssl[NGX_SSL_STAT_FAILED_CODE
+                                                  + n], 1);
+
+        return;
+    }
+
+    (void) ngx_atomic_fetch_add(&ngx_stat_ssl[NGX_SSL_STAT_HANDSHAKES], 1);
+
+    if (st) {
+        (void) ngx_atomic_fetch_add(&st[NGX_SSL_STAT_HANDSHAKES], 1);
+    }
+
+    if (c->ssl->reused) {
+        n = c->ssl->reused_ticket ? NGX_SSL_STAT_REUSED_TICKET
+                                  : NGX_SSL_STAT_REUSED_CACHE;
+
+        (void) ngx_atomic_fetch_add(&ngx_stat_ssl[n], 1);
+
+        if (st) {
+            (void) ngx_atomic_fetch_add(&st[n], 1);
+        }
+    }
+
+    usec = c->ssl->handshake_time;
+
+    (void) ngx_atomic_fetch_add(&ngx_stat_ssl[NGX_SSL_STAT_TIME], usec);
+
+    if (usec < 1000) {
+        n = NGX_SSL_STAT_TIME_1MS;
+
+    } else if (usec < 10000) {
+        n = NGX_SSL_STAT_TIME_10MS;
+
+    } else if (usec < 100000) {
+        n = NGX_SSL_STAT_TIME_100MS;
+
+    } else {
+        n = NGX_SSL_STAT_TIME_SLOW;
+    }
+
+    (void) ngx_atomic_fetch_add(&ngx_stat_ssl[n], 1);
+}
+
+#endif
+
+
+static void
+ngx_ssl_handshake_handler(ngx_event_t *ev)
+{
+    ngx_connection_t  *c;
+
+    c = ev->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL handshake handler: %d", ev->write);
+
+    if (ev->timedout) {
+        c->ssl->handler(c);
+        return;
+    }
+
+    if (ngx_ssl_handshake(c) == NGX_AGAIN) {
+        return;
+    }
+
+    c->ssl->handler(c);
+}
+
+
+#if (NGX_THREAD_POOL)
+
+static ngx_ssl_async_t *
+ngx_polarssl_async_create(ngx_connection_t *c, ngx_thread_pool_t *tp)
+{
+    ngx_ssl_async_t     *async;
+    ngx_pool_cleanup_t  *cln;
+
+    cln = ngx_pool_cleanup_add(c->pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    async = ngx_calloc(sizeof(ngx_ssl_async_t), c->log);
+    if (async == NULL) {
+        return NULL;
+    }
+
+    cln->handler = ngx_polarssl_async_cleanup;
+    cln->data = async;
+
+    async->thread_pool = tp;
+    async->connection = c;
+
+    async->task.ctx = async;
+    async->task.handler = ngx_polarssl_async_handler;
+    async->task.event.data = async;
+    async->task.event.handler = ngx_polarssl_async_done;
+    async->task.event.log = ngx_cycle->log;
+
+    return async;
+}
+
+
+static int
+ngx_polarssl_async_handshake(ngx_connection_t *c)
+{
+    int               sslerr;
+    ngx_ssl_conn_t   *ssl_conn;
+    ngx_ssl_async_t  *async;
+
+    async = c->ssl->async;
+    ssl_conn = c->ssl->connection;
+
+    if (async->running) {
+        return NGX_SSL_ASYNC;
+    }
+
+    if (async->done) {
+        async->done = 0;
+
+        /*
+         * the thread cannot send or receive, "want read" or "want write"
+         * just mean that the next step does it
+         */
+
+        sslerr = async->sslerr;
+
+        if (sslerr != 0
+            && sslerr != POLARSSL_ERR_NET_WANT_READ
+            && sslerr != POLARSSL_ERR_NET_WANT_WRITE)
+        {
+            return sslerr;
+        }
+    }
+
+    while (ssl_conn->state != SSL_HANDSHAKE_OVER) {
+
+        sslerr = ngx_polarssl_async_prepare(ssl_conn);
+
+        if (sslerr == NGX_SSL_ASYNC) {
+            if (ngx_polarssl_async_post(c) == NGX_OK) {
+                return NGX_SSL_ASYNC;
+            }
+
+            /* the step is done by the worker itself */
+
+        } else if (sslerr != 0) {
+            return sslerr;
+        }
+
+        sslerr = ngx_polarssl_handshake_step(c);
+
+        if (sslerr != 0) {
+            return sslerr;
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+ngx_polarssl_async_prepare(ngx_ssl_conn_t *ssl_conn)
+{
+    int                  sslerr;
+    size_t               len;
+    key_exchange_type_t  kx;
+
+    /*
+     * Only the steps doing a private key operation are offloaded:
+     * signing of the ServerKeyExchange parameters for DHE and ECDHE,
+     * and decryption of the RSA premaster secret.
+     */
+
+    switch (ssl_conn->state) {
+
+    case SSL_SERVER_KEY_EXCHANGE:
+
+        kx = ssl_conn->transform_negotiate->ciphersuite_info->key_exchange;
+
+        if (kx != POLARSSL_KEY_EXCHANGE_DHE_RSA
+            && kx != POLARSSL_KEY_EXCHANGE_ECDHE_RSA
+            && kx != POLARSSL_KEY_EXCHANGE_ECDHE_ECDSA)
+        {
+            return 0;
+        }
+
+        /* ServerHello and Certificate are sent before */
+
+        sslerr = ssl_flush_output(ssl_conn);
+        if (sslerr != 0) {
+            return sslerr;
+        }
+
+        return NGX_SSL_ASYNC;
+
+    case SSL_CLIENT_KEY_EXCHANGE:
+
+        kx = ssl_conn->transform_negotiate->ciphersuite_info->key_exchange;
+
+        if (kx != POLARSSL_KEY_EXCHANGE_RSA) {
+            return 0;
+        }
+
+        /*
+         * the whole ClientKeyExchange record is read beforehand,
+         * unless it came in one record with the previous message
+         */
+
+        if (ssl_conn->in_hslen != 0
+            && ssl_conn->in_hslen < ssl_conn->in_msglen)
+        {
+            return NGX_SSL_ASYNC;
+        }
+
+        sslerr = ngx_polarssl_fetch_record(ssl_conn, &len);
+        if (sslerr != 0) {
+            return sslerr;
+        }
+
+        return NGX_SSL_ASYNC;
+
+    default:
+        return 0;
+    }
+}
+
+
+static ngx_int_t
+ngx_polarssl_async_post(ngx_connection_t *c)
+{
+    int               sslerr;
+    ngx_ssl_async_t  *async;
+
+    async = c->ssl->async;
+
+    /*
+     * the worker's DRBG is not locked, the thread uses
+     * a child one seeded from it for this step only
+     */
+
+    sslerr = ctr_drbg_init(&async->ctr_drbg, ctr_drbg_random, &ngx_ctr_drbg,
+                           NULL, 0);
+    if (sslerr != 0) {
+        ngx_polarssl_error(NGX_LOG_ALERT, c->log, 0, sslerr,
+                           "ctr_drbg_init() failed");
+        return NGX_ERROR;
     }
 
-    cert = ssl_get_peer_cert(c->ssl->connection);
+    ssl_set_bio(&async->ssl_conn, ngx_polarssl_async_recv, NULL,
+                ngx_polarssl_async_send, NULL);
+    ssl_set_rng(&async->ssl_conn, ctr_drbg_random, &async->ctr_drbg);
 
-    if (cert) {
-        ngx_str_set(s, "SUCCESS");
-    } else {
-        ngx_str_set(s, "NONE");
+    if (ngx_thread_task_post(async->thread_pool, &async->task) != NGX_OK) {
+        ngx_polarssl_async_restore(async, c);
+        return NGX_ERROR;
     }
 
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL handshake step %d posted", async->ssl_conn.state);
+
+    async->running = 1;
+
     return NGX_OK;
 }
 
 
-ngx_int_t
-ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c,
-    ngx_uint_t flags)
+static void
+ngx_polarssl_async_restore(ngx_ssl_async_t *async, ngx_connection_t *c)
 {
-    ngx_ssl_connection_t     *sc;
-    ngx_ssl_conn_t           *ssl_ctx;
-    ngx_ssl_session_cache_t  *cache;
-    int                       sslerr;
+    ssl_set_bio(&async->ssl_conn, ngx_polarssl_bio_recv, c,
+                ngx_polarssl_bio_send, c);
+    ssl_set_rng(&async->ssl_conn, ctr_drbg_random, &ngx_ctr_drbg);
 
-    sc = ngx_pcalloc(c->pool, sizeof(ngx_ssl_connection_t));
-    if (sc == NULL) {
-        return NGX_ERROR;
-    }
+    ngx_memzero(&async->ctr_drbg, sizeof(ctr_drbg_context));
+}
 
-    sc->buffer = ((flags % NGX_SSL_BUFFER) != 0);
 
-    /* Allocate the PolarSSL context */
+static void
+ngx_polarssl_async_handler(void *data, ngx_log_t *log)
+{
+    ngx_ssl_async_t  *async = data;
 
-    ssl_ctx = ngx_pcalloc(c->pool, sizeof(ngx_ssl_conn_t));
-    if (sc == NULL) {
-        return NGX_ERROR;
-    }
+    ngx_uint_t  start;
 
-    /*
-     * Initialize this PolarSSL context
-     *
-     * Note: We also setup the options traditionally set in ngx_ssl_create
-     * here since each ssl_ctx is unique to each fd.
-     */
+    start = ngx_polarssl_usec();
 
-    sslerr = ssl_init(ssl_ctx);
-    if (sslerr != 0) {
-        ngx_polarssl_error(NGX_LOG_ALERT, ssl->log, 0, sslerr,
-                           "ssl_init failed");
-        return NGX_ERROR;
-    }
+    async->sslerr = ssl_handshake_step(&async->ssl_conn);
 
-    if (flags & NGX_SSL_CLIENT) {
-        ssl_set_endpoint(ssl_ctx, SSL_IS_CLIENT);
+    async->time = ngx_polarssl_usec() - start;
+}
 
-        if (ssl->have_own_cert) {
-            ssl_set_own_cert_rsa(ssl_ctx, &ssl->own_cert, &ssl->own_key);
-        }
-    } else {
-        ssl_set_endpoint(ssl_ctx, SSL_IS_SERVER);
-        ssl_set_own_cert_rsa(ssl_ctx, &ssl->own_cert, &ssl->own_key);
-    }
 
-    if (ssl->have_ca_cert) {
-        if (ssl->have_ca_crl) {
-            ssl_set_ca_chain(ssl_ctx, &ssl->ca_cert, &ssl->ca_crl, NULL);
-        } else {
-            ssl_set_ca_chain(ssl_ctx, &ssl->ca_cert, NULL, NULL);
-        }
+static void
+ngx_polarssl_async_done(ngx_event_t *ev)
+{
+    ngx_ssl_async_t   *async;
+    ngx_connection_t  *c;
 
-        /*
-         * ngx_event_openssl has the callback rigged to allow the handshake
-         * to continue even if verification fails.  We shall do the same.
-         */
+    async = ev->data;
+    c = async->connection;
 
-        ssl_set_authmode(ssl_ctx, SSL_VERIFY_OPTIONAL);
-    } else {
-        ssl_set_authmode(ssl_ctx, SSL_VERIFY_NONE);
+    async->running = 0;
+
+    if (c == NULL) {
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "SSL handshake step of closed connection: %d",
+                       async->sslerr);
+
+        ngx_memzero(&async->ctr_drbg, sizeof(ctr_drbg_context));
+        ngx_polarssl_free(&async->ssl_conn);
+        ngx_free(async);
+        return;
     }
 
-    ssl_set_min_version(ssl_ctx, SSL_MAJOR_VERSION_3, ssl->minor_min);
-    ssl_set_max_version(ssl_ctx, SSL_MAJOR_VERSION_3, ssl->minor_max);
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL handshake step done: %d", async->sslerr);
 
-    ssl_set_renegotiation(ssl_ctx, SSL_RENEGOTIATION_ENABLED);
-    ssl_legacy_renegotiation(ssl_ctx, SSL_LEGACY_NO_RENEGOTIATION);
+    ngx_polarssl_async_restore(async, c);
 
-    ssl_set_rng(ssl_ctx, ngx_polarssl_rng, &ngx_ctr_drbg);
-    ssl_set_bio(ssl_ctx, net_recv, &c->fd, net_send, &c->fd);
+    c->ssl->handshake_time += async->time;
 
-    ssl_set_dh_param_ctx(ssl_ctx, &ssl->dhm_ctx);
-    ssl_set_ciphersuites(ssl_ctx, ssl->ciphersuites);
+    async->done = 1;
 
-    if (ssl->builtin_session_cache == NGX_SSL_NONE_SCACHE) {
-        ssl_set_session_cache(ssl_ctx,
-                ngx_polarssl_get_cache, NULL,
-                ngx_polarssl_set_cache, NULL);
-    }
+    ngx_ssl_handshake_handler(c->read);
+}
 
-    if (ssl->builtin_session_cache != NGX_SSL_NO_SCACHE) {
-        cache = ssl->cache_shm_zone->data;
-        cache->ttl = ssl->cache_ttl;
 
-        ssl_set_session_cache(ssl_ctx,
-                ngx_polarssl_get_cache, ssl->cache_shm_zone,
-                ngx_polarssl_set_cache, ssl->cache_shm_zone);
-    }
+static void
+ngx_polarssl_async_cleanup(void *data)
+{
+    ngx_ssl_async_t  *async = data;
 
-    if (ssl->sni_fn) {
-        ssl_set_sni(ssl_ctx, ssl->sni_fn, c);
-    }
+    if (async->running) {
 
-    /* All done, the connection is good to go now */
+        /* freed by ngx_polarssl_async_done() */
 
-    sc->connection = ssl_ctx;
-    c->ssl = sc;
-    
-    return NGX_OK;
+        async->connection = NULL;
+        return;
+    }
+
+    ngx_free(async);
 }
 
 
-ngx_int_t
-ngx_ssl_handshake(ngx_connection_t *c)
+static int
+ngx_polarssl_async_recv(void *ctx, unsigned char *buf, size_t len)
 {
-    int  sslerr;
+    return POLARSSL_ERR_NET_WANT_READ;
+}
 
-    sslerr = ssl_handshake(c->ssl->connection);
 
-    if (sslerr == 0) {
-        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
-            return NGX_ERROR;
-        }
+static int
+ngx_polarssl_async_send(void *ctx, const unsigned char *buf, size_t len)
+{
+    return POLARSSL_ERR_NET_WANT_WRITE;
+}
 
-        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
-            return NGX_ERROR;
-        }
+#endif
 
-        c->ssl->handshaked = 1;
 
-        c->recv = ngx_ssl_recv;
-        c->send = ngx_ssl_write;
-        c->recv_chain = ngx_ssl_recv_chain;
-        c->send_chain = ngx_ssl_send_chain;
+#if (NGX_HAVE_KTLS)
 
-        /*
-         * Versions of PolarSSL this is developed against are not vulnerable
-         * to CVE-2009-3555, leave renegotiaton as is.
-         */
+/*
+ * After the handshake the encryption of the records sent is passed to
+ * the kernel, and the connection sends with the usual send_chain, so
+ * files go with sendfile().  Only TLS 1.2 AES-GCM without compression
+ * is supported, in other cases the connection stays with PolarSSL.
+ *
+ * PolarSSL does not keep the negotiated key, though the first round
+ * keys of the AES key schedule are the key itself.  The salt is the
+ * fixed part of the IV, and the explicit nonce is the record sequence
+ * number.
+ */
 
-        return NGX_OK;
+static void
+ngx_polarssl_ktls(ngx_connection_t *c)
+{
+    u_char                                 *key, *iv, *salt, *rec_seq;
+    size_t                                  len, keylen;
+    uint32_t                               *rk;
+    ngx_uint_t                              i;
+    aes_context                            *aes;
+    gcm_context                            *gcm;
+    ssl_transform                          *transform;
+    ngx_ssl_conn_t                         *ssl_conn;
+    struct tls12_crypto_info_aes_gcm_128    ci128;
+    struct tls12_crypto_info_aes_gcm_256    ci256;
+    struct tls_crypto_info                 *ci;
+
+    ssl_conn = c->ssl->connection;
+    transform = ssl_conn->transform_out;
+
+    if (ssl_conn->minor_ver != SSL_MINOR_VERSION_3
+        || ssl_conn->session->compression != SSL_COMPRESS_NULL
+        || ssl_conn->out_left != 0
+        || transform == NULL)
+    {
+        goto failed;
     }
 
-    if (sslerr == POLARSSL_ERR_NET_WANT_READ) {
-        c->read->ready = 0;
-        c->read->handler = ngx_ssl_handshake_handler;
-        c->write->handler = ngx_ssl_handshake_handler;
+    switch (transform->cipher_ctx_enc.cipher_info->type) {
+
+    case POLARSSL_CIPHER_AES_128_GCM:
+        ngx_memzero(&ci128, sizeof(ci128));
+        ci = &ci128.info;
+        ci->cipher_type = TLS_CIPHER_AES_GCM_128;
+        key = ci128.key;
+        keylen = TLS_CIPHER_AES_GCM_128_KEY_SIZE;
+        iv = ci128.iv;
+        salt = ci128.salt;
+        rec_seq = ci128.rec_seq;
+        len = sizeof(ci128);
+        break;
+
+    case POLARSSL_CIPHER_AES_256_GCM:
+        ngx_memzero(&ci256, sizeof(ci256));
+        ci = &ci256.info;
+        ci->cipher_type = TLS_CIPHER_AES_GCM_256;
+        key = ci256.key;
+        keylen = TLS_CIPHER_AES_GCM_256_KEY_SIZE;
+        iv = ci256.iv;
+        salt = ci256.salt;
+        rec_seq = ci256.rec_seq;
+        len = sizeof(ci256);
+        break;
+
+    default:
+        goto failed;
+    }
 
-        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    ci->version = TLS_1_2_VERSION;
 
-        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    gcm = transform->cipher_ctx_enc.cipher_ctx;
+    aes = gcm->cipher_ctx.cipher_ctx;
+    rk = aes->rk;
 
-        return NGX_AGAIN;
+    for (i = 0; i < keylen / 4; i++) {
+        key[i * 4] = (u_char) rk[i];
+        key[i * 4 + 1] = (u_char) (rk[i] >> 8);
+        key[i * 4 + 2] = (u_char) (rk[i] >> 16);
+        key[i * 4 + 3] = (u_char) (rk[i] >> 24);
     }
 
-    if (sslerr == POLARSSL_ERR_NET_WANT_WRITE) {
-        c->write->ready = 0;
-        c->read->handler = ngx_ssl_handshake_handler;
-        c->write->handler = ngx_ssl_handshake_handler;
+    ngx_memcpy(salt, transform->iv_enc, 4);
+    ngx_memcpy(rec_seq, ssl_conn->out_ctr, 8);
+    ngx_memcpy(iv, ssl_conn->out_ctr, 8);
 
-        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    if (setsockopt(c->fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) == -1) {
+        ngx_log_error(NGX_LOG_INFO, c->log, ngx_socket_errno,
+                      "setsockopt(TCP_ULP, \"tls\") failed, "
+                      "kernel TLS is not used");
+        ngx_memzero(key, keylen);
+        goto failed;
+    }
 
-        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    /* a socket with the TLS ULP but without TLS_TX sends plain data as is */
 
-        return NGX_AGAIN;
+    if (setsockopt(c->fd, SOL_TLS, TLS_TX, ci, len) == -1) {
+        ngx_log_error(NGX_LOG_INFO, c->log, ngx_socket_errno,
+                      "setsockopt(TLS_TX) failed, kernel TLS is not used");
+        ngx_memzero(key, keylen);
+        goto failed;
     }
 
-    c->ssl->no_send_shutdown = 1;
-    c->read->eof = 1;
+    ngx_memzero(key, keylen);
 
-    if (sslerr == POLARSSL_ERR_SSL_CONN_EOF) {
-        ngx_log_error(NGX_LOG_INFO, c->log, 0,
-                      "peer closed connection in SSL handshake");
-        return NGX_ERROR;
-    }
+    /* nothing may be sent by PolarSSL itself any more */
 
-    c->read->error = 1;
+    ssl_set_bio(ssl_conn, ngx_polarssl_bio_recv, c, ngx_polarssl_ktls_send, c);
 
-    ngx_polarssl_error(NGX_LOG_ERR, c->log, 0, sslerr, "ssl_handshake() failed");
+    c->send = ngx_send;
+    c->send_chain = ngx_send_chain;
 
-    return NGX_ERROR;
-}
+    c->ssl->sendfile = 1;
 
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL kernel TLS enabled: %s",
+                   ssl_get_ciphersuite(ssl_conn));
 
-static void
-ngx_ssl_handshake_handler(ngx_event_t *ev)
-{
-    ngx_connection_t  *c;
+    return;
 
-    c = ev->data;
+failed:
 
-    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                   "SSL handshake handler: %d", ev->write);
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL kernel TLS not used");
+}
 
-    if (ev->timedout) {
-        c->ssl->handler(c);
-        return;
-    }
 
-    if (ngx_ssl_handshake(c) == NGX_AGAIN) {
-        return;
-    }
+static int
+ngx_polarssl_ktls_send(void *ctx, const unsigned char *buf, size_t len)
+{
+    ngx_connection_t  *c = ctx;
 
-    c->ssl->handler(c);
+    ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                  "SSL record not sent, kernel TLS is used");
+
+    return POLARSSL_ERR_NET_SEND_FAILED;
 }
 
+#endif
+
 
 ssize_t
 ngx_ssl_recv(ngx_connection_t *c, u_char *buf, size_t size)
@@ -1305,6 +4233,11 @@ ngx_ssl_recv(ngx_connection_t *c, u_char *buf, size_t size)
         return 0;
     }
 
+    if (c->ssl->released && ngx_polarssl_restore_buffers(c) != NGX_OK) {
+        c->read->error = 1;
+        return NGX_ERROR;
+    }
+
     bytes = 0;
 
     for ( ;; ) {
@@ -1427,16 +4360,64 @@ ngx_ssl_write_handler(ngx_event_t *wev)
 ssize_t
 ngx_ssl_write(ngx_connection_t *c, u_char *data, size_t size)
 {
-    int  n;
+    int                    n;
+    ngx_ssl_connection_t  *sc;
+
+    sc = c->ssl;
+
+    if (sc->released && ngx_polarssl_restore_buffers(c) != NGX_OK) {
+        c->write->error = 1;
+        return NGX_ERROR;
+    }
+
+    if (sc->write_pending) {
+
+        /*
+         * ssl_write() only flushes a record left in its output buffer and
+         * returns the length it was called with, so the retry has to use
+         * the length the record was built from
+         */
+
+        size = sc->write_pending;
+
+    } else if (sc->dyn_rec.enable) {
+
+        /*
+         * ssl_write() puts at most one record on the wire per call, so
+         * limiting the size written limits the record size.  The first
+         * records of a response, or of one sent after an idle period,
+         * are kept small enough to fit into a single TCP segment: the
+         * client can decrypt them as soon as they arrive.  After the
+         * threshold the records grow to the full 16K to save on per
+         * record overhead.
+         */
+
+        if (ngx_current_msec - sc->dyn_rec_last_write > sc->dyn_rec.timeout) {
+            sc->dyn_rec_records = 0;
+        }
+
+        if (sc->dyn_rec_records < sc->dyn_rec.threshold
+            && size > sc->dyn_rec.size_lo)
+        {
+            size = sc->dyn_rec.size_lo;
+        }
+    }
 
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL to write: %d", size);
 
-    n = ssl_write(c->ssl->connection, data, size);
+    n = ssl_write(sc->connection, data, size);
 
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "ssl_write: %d", n);
 
+    sc->write_pending = (sc->connection->out_left != 0) ? size : 0;
+
     if (n > 0) {
 
+        if (sc->dyn_rec.enable) {
+            sc->dyn_rec_last_write = ngx_current_msec;
+            sc->dyn_rec_records++;
+        }
+
         if (c->ssl->saved_read_handler) {
 
             c->read->handler = c->ssl->saved_read_handler;
@@ -1538,21 +4519,90 @@ ngx_ssl_recv_chain(ngx_connection_t *c, ngx_chain_t *cl)
             continue;
         }
 
-        if (bytes) {
-            if (n == 0 || n == NGX_ERROR) {
-                c->read->ready = 1;
-            }
+        if (bytes) {
+            if (n == 0 || n == NGX_ERROR) {
+                c->read->ready = 1;
+            }
+
+            return bytes;
+        }
+
+        return n;
+    }
+}
+
+
+ngx_chain_t *
+ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
+{
+    int          sslerr;
+    ngx_buf_t   *b;
+
+    if (!c->ssl->buffer) {
+        return ngx_polarssl_send_chain(c, in, limit);
+    }
+
+    b = c->ssl->write_gather;
+
+    if (b == NULL) {
+        b = ngx_calloc_buf(c->pool);
+        if (b == NULL) {
+            return NGX_CHAIN_ERROR;
+        }
+
+        c->ssl->write_gather = b;
+    }
+
+    if (b->start == NULL) {
+        b->start = ngx_palloc(c->pool, NGX_SSL_WRITE_GATHER_SIZE);
+        if (b->start == NULL) {
+            return NGX_CHAIN_ERROR;
+        }
+
+        b->pos = b->start;
+        b->last = b->start;
+        b->end = b->start + NGX_SSL_WRITE_GATHER_SIZE;
+    }
+
+    /*
+     * the records written by ngx_ssl_write() are gathered
+     * in the buffer and sent together at the end of the call
+     */
+
+    c->ssl->gather = 1;
+
+    in = ngx_polarssl_send_chain(c, in, limit);
+
+    c->ssl->gather = 0;
+
+    if (in == NGX_CHAIN_ERROR) {
+        return NGX_CHAIN_ERROR;
+    }
+
+    sslerr = ngx_polarssl_bio_flush(c);
+
+    if (sslerr == POLARSSL_ERR_NET_WANT_WRITE) {
+        c->write->ready = 0;
+        c->buffered |= NGX_SSL_BUFFERED;
+        return in;
+    }
+
+    if (sslerr != 0) {
+        c->ssl->no_send_shutdown = 1;
+        c->write->error = 1;
 
-            return bytes;
-        }
+        ngx_polarssl_error(NGX_LOG_ERR, c->log, ngx_socket_errno, sslerr,
+                           "send() failed");
 
-        return n;
+        return NGX_CHAIN_ERROR;
     }
+
+    return in;
 }
 
 
-ngx_chain_t *
-ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
+static ngx_chain_t *
+ngx_polarssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 {
     int          n;
     ngx_uint_t   flush;
@@ -1597,7 +4647,7 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
     buf = c->ssl->buf;
 
     if (buf == NULL) {
-        buf = ngx_create_temp_buf(c->pool, NGX_SSL_BUFSIZE);
+        buf = ngx_create_temp_buf(c->pool, c->ssl->buffer_size);
         if (buf == NULL) {
             return NGX_CHAIN_ERROR;
         }
@@ -1605,6 +4655,17 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
         c->ssl->buf = buf;
     }
 
+    if (buf->start == NULL) {
+        buf->start = ngx_palloc(c->pool, c->ssl->buffer_size);
+        if (buf->start == NULL) {
+            return NGX_CHAIN_ERROR;
+        }
+
+        buf->pos = buf->start;
+        buf->last = buf->start;
+        buf->end = buf->start + c->ssl->buffer_size;
+    }
+
     send = buf->last - buf->pos;
     flush = (in == NULL) ? 1 : buf->flush;
 
@@ -1670,7 +4731,13 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
         c->sent += n;
 
         if (n < size) {
-            break;
+
+            /*
+             * unlike SSL_write(), ssl_write() returns after a single
+             * record, the rest of the buffer is still to be sent
+             */
+
+            continue;
         }
 
         flush = 0;
@@ -1696,15 +4763,390 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 }
 
 
+static int
+ngx_polarssl_bio_recv(void *ctx, unsigned char *buf, size_t len)
+{
+    ngx_connection_t  *c = ctx;
+
+    ssize_t     n;
+    ngx_err_t   err;
+    ngx_buf_t  *b;
+
+    /*
+     * PolarSSL asks for the record header and then for the rest of
+     * the record, instead of two recv() calls per record as much as
+     * the socket has is read at once and the records are taken from
+     * the buffer
+     */
+
+    b = c->ssl->read_ahead;
+
+    if (b == NULL) {
+        b = ngx_calloc_buf(c->pool);
+        if (b == NULL) {
+            return POLARSSL_ERR_SSL_MALLOC_FAILED;
+        }
+
+        c->ssl->read_ahead = b;
+    }
+
+    if (b->start == NULL) {
+        b->start = ngx_palloc(c->pool, NGX_SSL_READ_AHEAD_SIZE);
+        if (b->start == NULL) {
+            return POLARSSL_ERR_SSL_MALLOC_FAILED;
+        }
+
+        b->pos = b->start;
+        b->last = b->start;
+        b->end = b->start + NGX_SSL_READ_AHEAD_SIZE;
+    }
+
+    if (b->pos == b->last) {
+
+        b->pos = b->start;
+        b->last = b->start;
+
+        for ( ;; ) {
+            n = recv(c->fd, b->start, b->end - b->start, 0);
+
+            ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "SSL read ahead: fd:%d %z of %uz",
+                           c->fd, n, (size_t) (b->end - b->start));
+
+            if (n >= 0) {
+                break;
+            }
+
+            err = ngx_socket_errno;
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            if (err == NGX_EAGAIN) {
+                return POLARSSL_ERR_NET_WANT_READ;
+            }
+
+            if (err == NGX_ECONNRESET) {
+                return POLARSSL_ERR_NET_CONN_RESET;
+            }
+
+            return POLARSSL_ERR_NET_RECV_FAILED;
+        }
+
+        if (n == 0) {
+            return 0;
+        }
+
+        b->last += n;
+    }
+
+    n = ngx_min(len, (size_t) (b->last - b->pos));
+
+    ngx_memcpy(buf, b->pos, n);
+    b->pos += n;
+
+    return (int) n;
+}
+
+
+static int
+ngx_polarssl_bio_send(void *ctx, const unsigned char *buf, size_t len)
+{
+    ngx_connection_t  *c = ctx;
+
+    int         sslerr;
+    ssize_t     n;
+    ngx_err_t   err;
+    ngx_buf_t  *b;
+
+    b = c->ssl->write_gather;
+
+    if (c->ssl->gather) {
+
+        if ((size_t) (b->end - b->last) < len && b->pos < b->last) {
+            sslerr = ngx_polarssl_bio_flush(c);
+            if (sslerr != 0) {
+                return sslerr;
+            }
+        }
+
+        if ((size_t) (b->end - b->last) >= len) {
+            ngx_memcpy(b->last, buf, len);
+            b->last += len;
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "SSL gather: %uz of %uz", len,
+                           (size_t) (b->last - b->pos));
+
+            return (int) len;
+        }
+    }
+
+    /* the records gathered before go first */
+
+    if (b && b->pos < b->last) {
+        sslerr = ngx_polarssl_bio_flush(c);
+        if (sslerr != 0) {
+            return sslerr;
+        }
+    }
+
+    for ( ;; ) {
+        n = send(c->fd, buf, len, 0);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "SSL send: fd:%d %z of %uz", c->fd, n, len);
+
+        if (n >= 0) {
+            return (int) n;
+        }
+
+        err = ngx_socket_errno;
+
+        if (err == NGX_EINTR) {
+            continue;
+        }
+
+        if (err == NGX_EAGAIN) {
+            return POLARSSL_ERR_NET_WANT_WRITE;
+        }
+
+        if (err == NGX_ECONNRESET || err == NGX_EPIPE) {
+            return POLARSSL_ERR_NET_CONN_RESET;
+        }
+
+        return POLARSSL_ERR_NET_SEND_FAILED;
+    }
+}
+
+
+static int
+ngx_polarssl_bio_flush(ngx_connection_t *c)
+{
+    ssize_t     n, size;
+    ngx_err_t   err;
+    ngx_buf_t  *b;
+
+    b = c->ssl->write_gather;
+
+    while (b->pos < b->last) {
+
+        size = b->last - b->pos;
+
+        n = send(c->fd, b->pos, size, 0);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "SSL flush: fd:%d %z of %z", c->fd, n, size);
+
+        if (n >= 0) {
+            b->pos += n;
+
+            if (n < size) {
+
+                /* the socket buffer is full, do not wait for EAGAIN */
+
+                return POLARSSL_ERR_NET_WANT_WRITE;
+            }
+
+            continue;
+        }
+
+        err = ngx_socket_errno;
+
+        if (err == NGX_EINTR) {
+            continue;
+        }
+
+        if (err == NGX_EAGAIN) {
+            return POLARSSL_ERR_NET_WANT_WRITE;
+        }
+
+        if (err == NGX_ECONNRESET || err == NGX_EPIPE) {
+            return POLARSSL_ERR_NET_CONN_RESET;
+        }
+
+        return POLARSSL_ERR_NET_SEND_FAILED;
+    }
+
+    b->pos = b->start;
+    b->last = b->start;
+
+    return 0;
+}
+
+
 void
 ngx_ssl_free_buffer(ngx_connection_t *c)
 {
+    ngx_buf_t  *b;
 
     if (c->ssl->buf && c->ssl->buf->start) {
         if (ngx_pfree(c->pool, c->ssl->buf->start) == NGX_OK) {
             c->ssl->buf->start = NULL;
         }
     }
+
+    /* the buffers may still hold records of the next request */
+
+    b = c->ssl->read_ahead;
+
+    if (b && b->start && b->pos == b->last) {
+        if (ngx_pfree(c->pool, b->start) == NGX_OK) {
+            b->start = NULL;
+        }
+    }
+
+    b = c->ssl->write_gather;
+
+    if (b && b->start && b->pos == b->last) {
+        if (ngx_pfree(c->pool, b->start) == NGX_OK) {
+            b->start = NULL;
+        }
+    }
+
+    ngx_polarssl_release_buffers(c);
+}
+
+
+static void
+ngx_polarssl_release_buffers(ngx_connection_t *c)
+{
+    u_char                    *p;
+    ngx_ssl_conn_t            *ssl_conn;
+    ngx_ssl_record_buffers_t  *rb;
+
+    /*
+     * ssl_init() allocates about 17K for each of the input and output
+     * record buffers, they are released while the connection is idle
+     * and taken again from the worker's free list once it is used
+     */
+
+    ssl_conn = c->ssl->connection;
+
+    if (c->ssl->released
+        || !c->ssl->handshaked
+        || ssl_conn->state != SSL_HANDSHAKE_OVER
+        || ssl_conn->in_left
+        || ssl_conn->in_msglen
+        || ssl_conn->in_offt
+        || ssl_conn->out_left)
+    {
+        return;
+    }
+
+    rb = &c->ssl->record_buffers;
+
+    ngx_memcpy(rb->in_ctr, ssl_conn->in_ctr, 8);
+    rb->in_hdr = (u_short) (ssl_conn->in_hdr - ssl_conn->in_ctr);
+    rb->in_iv = (u_short) (ssl_conn->in_iv - ssl_conn->in_ctr);
+    rb->in_msg = (u_short) (ssl_conn->in_msg - ssl_conn->in_ctr);
+
+    ngx_memcpy(rb->out_ctr, ssl_conn->out_ctr, 8);
+    rb->out_hdr = (u_short) (ssl_conn->out_hdr - ssl_conn->out_ctr);
+    rb->out_iv = (u_short) (ssl_conn->out_iv - ssl_conn->out_ctr);
+    rb->out_msg = (u_short) (ssl_conn->out_msg - ssl_conn->out_ctr);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL release buffers: %p %p",
+                   ssl_conn->in_ctr, ssl_conn->out_ctr);
+
+    p = ssl_conn->in_ctr;
+
+    for ( ;; ) {
+
+        /* the buffers may hold plaintext of the previous records */
+
+        ngx_memzero(p, SSL_BUFFER_LEN);
+
+        if (ngx_polarssl_nfree_buffers < NGX_SSL_MAX_FREE_BUFFERS) {
+            *(u_char **) p = ngx_polarssl_free_buffers;
+            ngx_polarssl_free_buffers = p;
+            ngx_polarssl_nfree_buffers++;
+
+        } else {
+            polarssl_free(p);
+        }
+
+        if (p == ssl_conn->out_ctr) {
+            break;
+        }
+
+        p = ssl_conn->out_ctr;
+    }
+
+    /* ssl_free() skips the NULL buffers */
+
+    ssl_conn->in_ctr = NULL;
+    ssl_conn->in_hdr = NULL;
+    ssl_conn->in_iv = NULL;
+    ssl_conn->in_msg = NULL;
+
+    ssl_conn->out_ctr = NULL;
+    ssl_conn->out_hdr = NULL;
+    ssl_conn->out_iv = NULL;
+    ssl_conn->out_msg = NULL;
+
+    c->ssl->released = 1;
+}
+
+
+static ngx_int_t
+ngx_polarssl_restore_buffers(ngx_connection_t *c)
+{
+    u_char                    *p[2];
+    ngx_uint_t                 i;
+    ngx_ssl_conn_t            *ssl_conn;
+    ngx_ssl_record_buffers_t  *rb;
+
+    for (i = 0; i < 2; i++) {
+
+        if (ngx_polarssl_free_buffers) {
+            p[i] = ngx_polarssl_free_buffers;
+            ngx_polarssl_free_buffers = *(u_char **) p[i];
+            ngx_polarssl_nfree_buffers--;
+            continue;
+        }
+
+        /* ssl_free() releases the buffers with polarssl_free() */
+
+        p[i] = polarssl_malloc(SSL_BUFFER_LEN);
+
+        if (p[i] == NULL) {
+            ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                          "polarssl_malloc(%uz) failed", SSL_BUFFER_LEN);
+
+            if (i == 1) {
+                polarssl_free(p[0]);
+            }
+
+            return NGX_ERROR;
+        }
+
+        ngx_memzero(p[i], SSL_BUFFER_LEN);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL restore buffers: %p %p", p[0], p[1]);
+
+    ssl_conn = c->ssl->connection;
+    rb = &c->ssl->record_buffers;
+
+    ssl_conn->in_ctr = p[0];
+    ngx_memcpy(ssl_conn->in_ctr, rb->in_ctr, 8);
+    ssl_conn->in_hdr = ssl_conn->in_ctr + rb->in_hdr;
+    ssl_conn->in_iv = ssl_conn->in_ctr + rb->in_iv;
+    ssl_conn->in_msg = ssl_conn->in_ctr + rb->in_msg;
+
+    ssl_conn->out_ctr = p[1];
+    ngx_memcpy(ssl_conn->out_ctr, rb->out_ctr, 8);
+    ssl_conn->out_hdr = ssl_conn->out_ctr + rb->out_hdr;
+    ssl_conn->out_iv = ssl_conn->out_ctr + rb->out_iv;
+    ssl_conn->out_msg = ssl_conn->out_ctr + rb->out_msg;
+
+    c->ssl->released = 0;
+
+    return NGX_OK;
 }
 
 
@@ -1758,17 +5200,44 @@ ngx_ssl_shutdown(ngx_connection_t *c)
 {
     int  sslerr;
 
-    if (c->timedout || c->ssl->no_send_shutdown || c->ssl->no_wait_shutdown) {
-        ssl_free(c->ssl->connection);
+#if (NGX_THREAD_POOL)
+
+    if (c->ssl->async && c->ssl->async->running) {
+
+        /* the context is freed by the completion handler */
+
+        c->ssl->async->connection = NULL;
+        c->ssl = NULL;
+
+        return NGX_OK;
+    }
+
+#endif
+
+    /* with kernel TLS the alert could not be encrypted by PolarSSL */
+
+    if (c->timedout
+        || c->ssl->no_send_shutdown
+        || c->ssl->no_wait_shutdown
+        || c->ssl->sendfile)
+    {
+        ngx_polarssl_free(c->ssl->connection);
         c->ssl = NULL;
 
         return NGX_OK;
     }
 
+    if (c->ssl->released && ngx_polarssl_restore_buffers(c) != NGX_OK) {
+        ngx_polarssl_free(c->ssl->connection);
+        c->ssl = NULL;
+
+        return NGX_ERROR;
+    }
+
     sslerr = ssl_close_notify(c->ssl->connection);
 
     if (sslerr == 0 || sslerr == POLARSSL_ERR_SSL_CONN_EOF) {
-        ssl_free(c->ssl->connection);
+        ngx_polarssl_free(c->ssl->connection);
         c->ssl = NULL;
 
         return NGX_OK;
@@ -1797,7 +5266,7 @@ ngx_ssl_shutdown(ngx_connection_t *c)
     ngx_polarssl_error(NGX_LOG_ERR, c->log, 0, sslerr,
                        "ssl_close_notify() failed");
 
-    ssl_free(c->ssl->connection);
+    ngx_polarssl_free(c->ssl->connection);
     c->ssl = NULL;
 
     return NGX_ERROR;
@@ -1827,19 +5296,45 @@ ngx_ssl_shutdown_handler(ngx_event_t *ev)
 }
 
 
+static void
+ngx_polarssl_free(ngx_ssl_conn_t *ssl_conn)
+{
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+
+    /* the ticket keys are owned by ngx_ssl_t, do not let ssl_free() free them */
+
+    ssl_conn->ticket_keys = NULL;
+
+#endif
+
+    ssl_free(ssl_conn);
+}
+
+
 void
 ngx_ssl_cleanup_ctx(void *data)
 {
     ngx_ssl_t  *ssl = data;
 
+    ngx_uint_t           i;
+    ngx_ssl_key_cert_t  *kc;
+
     if (ssl->ciphersuites != NULL) {
         ngx_free(ssl->ciphersuites);
     }
 
+    if (ssl->ticket_keys) {
+        ngx_memzero(ssl->ticket_keys->elts,
+                    ssl->ticket_keys->nelts * ssl->ticket_keys->size);
+    }
+
     dhm_free(&ssl->dhm_ctx);
-    if (ssl->have_own_cert) {
-        x509_crt_free(&ssl->own_cert);
-        rsa_free(&ssl->own_key);
+    if (ssl->certificates) {
+        kc = ssl->certificates->elts;
+        for (i = 0; i < ssl->certificates->nelts; i++) {
+            x509_crt_free(&kc[i].cert);
+            pk_free(&kc[i].key);
+        }
     }
     if (ssl->have_ca_cert) {
         x509_crt_free(&ssl->ca_cert);
@@ -1923,6 +5418,8 @@ ngx_polarssl_set_cipher_list(ngx_ssl_t *ssl, const char *ciphers)
             case TLS_DHE_RSA_WITH_DES_CBC_SHA:
             case TLS_RSA_WITH_3DES_EDE_CBC_SHA:     /* Key size < 128 */
             case TLS_DHE_RSA_WITH_3DES_EDE_CBC_SHA: /* Key size < 128 */
+            case TLS_ECDHE_RSA_WITH_3DES_EDE_CBC_SHA:
+            case TLS_ECDHE_ECDSA_WITH_3DES_EDE_CBC_SHA:
                 continue;
                 break;
             }
@@ -2046,32 +5543,3 @@ ngx_polarssl_verify_error_str(int n)
 
     return NULL;
 }
-
-
-static int
-ngx_polarssl_rng(void *data, unsigned char *output, size_t output_len)
-{
-    int  rval;
-
-#if (NGX_THREADS)
-    ngx_mutex_lock(ngx_ctr_drbg_mutex);
-#endif
-
-    rval = ctr_drbg_random(data, output, output_len);
-
-#if (NGX_THREADS)
-    ngx_mutex_unlock(ngx_ctr_drbg_mutex);
-#endif
-
-    return rval;
-}
-
-
-static void
-ngx_polarssl_exit(ngx_cycle_t *cycle)
-{
-#if (NGX_THREADS)
-    ngx_mutex_destroy(ngx_ctr_drbg_mutex);
-#endif
-}
-
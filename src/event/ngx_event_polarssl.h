@@ -22,15 +22,45 @@
 #include "polarssl/certs.h"
 #include "polarssl/x509.h"
 #include "polarssl/error.h"
+#include "polarssl/ecp.h"
+#include "polarssl/gcm.h"
+#include "polarssl/sha256.h"
 
 
 #define NGX_SSL_NAME    "PolarSSL"
 
 
+#define NGX_SSL_MAX_CURVES      8
+
+
+/*
+ * The records are read from the socket ahead into a buffer of the record
+ * buffer size, and the records of a send_chain call are written with
+ * a single send() from a buffer of several records.
+ */
+
+#define NGX_SSL_READ_AHEAD_SIZE     SSL_BUFFER_LEN
+#define NGX_SSL_WRITE_GATHER_SIZE   (4 * SSL_BUFFER_LEN)
+
+
 #define ngx_ssl_session_t       ssl_session
 #define ngx_ssl_conn_t          ssl_context
 
 
+typedef struct {
+    x509_crt                    cert;
+    pk_context                  key;
+} ngx_ssl_key_cert_t;
+
+
+typedef struct {
+    ngx_flag_t                  enable;
+    ngx_msec_t                  timeout;
+    ngx_uint_t                  threshold;
+    size_t                      size_lo;
+} ngx_ssl_dyn_rec_t;
+
+
 typedef struct {
     ngx_log_t                  *log;
     void                       *data;
@@ -38,47 +68,125 @@ typedef struct {
     ssize_t                     builtin_session_cache;
     ngx_shm_zone_t             *cache_shm_zone;
     time_t                      cache_ttl;
-<<<<<<< HEAD
-=======
     size_t                      buffer_size;
->>>>>>> nginx-1.5
+    ngx_ssl_dyn_rec_t           dyn_rec;
 
     ngx_uint_t                  minor_min;
     ngx_uint_t                  minor_max;
 
     int                        *ciphersuites;
     dhm_context                 dhm_ctx;
-    x509_crt                   own_cert;
-    rsa_context                 own_key;
+#if defined(POLARSSL_ECP_C)
+    ecp_group_id                curves[NGX_SSL_MAX_CURVES + 1];
+#endif
+    ngx_array_t                *certificates;
     x509_crt                    ca_cert;
     x509_crl                    ca_crl;
+    ngx_array_t                *crl_index;
 
     int                         (*sni_fn)(void *, ssl_context *,
                                           const unsigned char *, size_t);
 
-    unsigned                    have_own_cert:1;
+    ngx_array_t                *ticket_keys;
+
+    ngx_shm_zone_t             *verify_cache_shm_zone;
+    time_t                      verify_cache_ttl;
+    u_char                      verify_cache_ctx[32];
+
+    ngx_atomic_t               *stat;
+
+#if (NGX_THREAD_POOL)
+    ngx_thread_pool_t          *thread_pool;
+#endif
+
     unsigned                    have_ca_cert:1;
     unsigned                    have_ca_crl:1;
+    unsigned                    session_tickets:1;
+    unsigned                    ktls:1;
 
     void                       *ctx;        /* Fake global state */
 } ngx_ssl_t;
 
 
+/*
+ * The state of the PolarSSL record buffers kept while they are released:
+ * the 64-bit record sequence numbers stored in front of the buffers,
+ * and the offsets of the record header, IV and message.
+ */
+
+typedef struct {
+    u_char                      in_ctr[8];
+    u_char                      out_ctr[8];
+    u_short                     in_hdr;
+    u_short                     in_iv;
+    u_short                     in_msg;
+    u_short                     out_hdr;
+    u_short                     out_iv;
+    u_short                     out_msg;
+} ngx_ssl_record_buffers_t;
+
+
+typedef struct ngx_ssl_async_s  ngx_ssl_async_t;
+
+
+/*
+ * The client certificate strings of a connection, either taken from
+ * the verify cache or formatted once and then kept for the variables.
+ */
+
+typedef struct {
+    ngx_str_t                   subject;
+    ngx_str_t                   issuer;
+    ngx_str_t                   serial;
+} ngx_ssl_verify_t;
+
+
 typedef struct {
     ngx_ssl_conn_t              *connection;
 
     ngx_int_t                   last;
     ngx_buf_t                   *buf;
+    size_t                      buffer_size;
+
+    ngx_buf_t                  *read_ahead;
+    ngx_buf_t                  *write_gather;
+
+    ngx_ssl_dyn_rec_t           dyn_rec;
+    ngx_msec_t                  dyn_rec_last_write;
+    ngx_uint_t                  dyn_rec_records;
+
+    size_t                      write_pending;
 
     ngx_connection_handler_pt   handler;
 
+    ngx_array_t                *ticket_keys;
+
+    ngx_ssl_t                  *verify_cache;
+    ngx_ssl_verify_t           *verify;
+    u_char                     *verify_hash;
+
     ngx_event_handler_pt        saved_read_handler;
     ngx_event_handler_pt        saved_write_handler;
 
+    ngx_ssl_record_buffers_t    record_buffers;
+
+    ngx_uint_t                  handshake_time;     /* microseconds */
+    ngx_atomic_t               *stat;
+
+#if (NGX_THREAD_POOL)
+    ngx_ssl_async_t            *async;
+#endif
+
     unsigned                    handshaked:1;
+    unsigned                    released:1;
     unsigned                    buffer:1;
+    unsigned                    gather:1;
     unsigned                    no_send_shutdown:1;
     unsigned                    no_wait_shutdown:1;
+    unsigned                    reused:1;
+    unsigned                    reused_ticket:1;
+    unsigned                    ktls:1;
+    unsigned                    sendfile:1;
 } ngx_ssl_connection_t;
 
 
@@ -88,23 +196,122 @@ typedef struct {
 #define NGX_SSL_DFLT_BUILTIN_SCACHE  -5
 
 
+#define NGX_SSL_SESSION_CACHE_SHARDS  8
+
+
 typedef struct ngx_ssl_sess_id_s ngx_ssl_sess_id_t;
 
+/*
+ * A cache entry keeps only what is needed to resume a session,
+ * node.key is the hash of the session id and node.data is its length.
+ */
+
 struct ngx_ssl_sess_id_s {
     ngx_rbtree_node_t           node;
     ngx_queue_t                 queue;
-    ngx_ssl_session_t          *session;
+    time_t                      expire;
+    int                         ciphersuite;
+    int                         compression;
+    u_char                      id[32];
+    u_char                      master[48];
 };
 
 
 typedef struct {
+    ngx_slab_pool_t            *shpool;
     ngx_rbtree_t                session_rbtree;
     ngx_rbtree_node_t           sentinel;
     ngx_queue_t                 expire_queue;
-    time_t                      ttl;
+    ngx_uint_t                  sessions;
+    ngx_uint_t                  hits;
+    ngx_uint_t                  misses;
+    ngx_uint_t                  evictions;
+} ngx_ssl_session_shard_t;
+
+
+typedef struct {
+    ngx_uint_t                  nshards;
+    ngx_ssl_session_shard_t    *shards[NGX_SSL_SESSION_CACHE_SHARDS];
+    ngx_uint_t                  loaded;     /* unsigned  loaded:1; */
 } ngx_ssl_session_cache_t;
 
 
+/*
+ * A verify cache entry is found by the SHA-256 hash of the certificate
+ * chain sent by the client together with the CA certificates and CRLs
+ * it was verified against, node.key is the start of the hash.  The
+ * subject DN, issuer DN and serial number follow the entry.
+ */
+
+typedef struct {
+    ngx_rbtree_node_t           node;
+    ngx_queue_t                 queue;
+    time_t                      expire;
+    int                         verify_result;
+    u_char                      hash[32];
+    u_short                     subject_len;
+    u_short                     issuer_len;
+    u_short                     serial_len;
+    u_char                      data[1];
+} ngx_ssl_verify_node_t;
+
+
+typedef struct {
+    ngx_slab_pool_t            *shpool;
+    ngx_rbtree_t                rbtree;
+    ngx_rbtree_node_t           sentinel;
+    ngx_queue_t                 expire_queue;
+} ngx_ssl_verify_cache_t;
+
+
+typedef struct {
+    ngx_uint_t                  sessions;
+    ngx_uint_t                  hits;
+    ngx_uint_t                  misses;
+    ngx_uint_t                  evictions;
+} ngx_ssl_cache_stat_t;
+
+
+/*
+ * The handshake counters of the server connections kept in ngx_stat_ssl[]
+ * for the stub_status module, the handshake time is in microseconds.
+ * Failed handshakes are also counted by the high-level part of the
+ * PolarSSL error code, -sslerr >> 7, the low-level only errors, such as
+ * the network ones, are counted in the first of these counters.
+ *
+ * The first NGX_SSL_SERVER_STAT_N counters are also kept per server in
+ * ngx_ssl_t.stat, if the stub_status module asks for them.
+ */
+
+#define NGX_SSL_STAT_HANDSHAKES         0
+#define NGX_SSL_STAT_REUSED_CACHE       1
+#define NGX_SSL_STAT_REUSED_TICKET      2
+#define NGX_SSL_STAT_FAILED             3
+#define NGX_SSL_STAT_TIME               4
+#define NGX_SSL_STAT_TIME_1MS           5
+#define NGX_SSL_STAT_TIME_10MS          6
+#define NGX_SSL_STAT_TIME_100MS         7
+#define NGX_SSL_STAT_TIME_SLOW          8
+#define NGX_SSL_STAT_FAILED_CODE        9
+
+#define NGX_SSL_STAT_CODES              256
+#define NGX_SSL_STAT_N                  (9 + NGX_SSL_STAT_CODES)
+
+#define NGX_SSL_SERVER_STAT_N           4
+
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+
+/*
+ * The 48-byte key file format used by ngx_event_openssl is kept:
+ * 16 bytes of key name, 16 bytes of AES key and 16 bytes of HMAC key.
+ */
+
+typedef ssl_ticket_keys  ngx_ssl_session_ticket_key_t;
+
+#endif
+
+
 #define NGX_SSL_SSLv2       0x0002
 #define NGX_SSL_SSLv3       0x0004
 #define NGX_SSL_TLSv1       0x0008
@@ -120,13 +327,17 @@ typedef struct {
 
 ngx_int_t ngx_ssl_init(ngx_log_t *log);
 ngx_int_t ngx_ssl_create(ngx_ssl_t *ssl, ngx_uint_t protocols, void *data);
+ngx_int_t ngx_ssl_certificates(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_array_t *certs, ngx_array_t *keys);
 ngx_int_t ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_str_t *cert, ngx_str_t *key);
+ngx_int_t ngx_ssl_use_certificates(ngx_ssl_conn_t *ssl_conn, ngx_ssl_t *ssl);
 ngx_int_t ngx_ssl_client_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_str_t *cert, ngx_int_t depth);
 ngx_int_t ngx_ssl_trusted_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_str_t *cert, ngx_int_t depth);
 ngx_int_t ngx_ssl_crl(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *crl);
+void ngx_ssl_use_ca_chain(ngx_ssl_connection_t *sc, ngx_ssl_t *ssl);
 ngx_int_t ngx_ssl_stapling(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_str_t *file, ngx_str_t *responder, ngx_uint_t verify);
 ngx_int_t ngx_ssl_stapling_resolver(ngx_conf_t *cf, ngx_ssl_t *ssl,
@@ -137,15 +348,24 @@ ngx_int_t ngx_ssl_cipher_list(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_str_t *ciphers);
 void ngx_ssl_sni_fn(ngx_ssl_t *ssl, int (*sni_fn)(void *, ssl_context *,
     const unsigned char *, size_t));
+#if (NGX_THREAD_POOL)
+ngx_int_t ngx_ssl_thread_pool(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_thread_pool_t *tp);
+#endif
 
 ngx_int_t ngx_ssl_session_cache(ngx_ssl_t *ssl, ngx_str_t *sess_ctx,
     ssize_t builtin_session_cache, ngx_shm_zone_t *shm_zone, time_t timeout);
 ngx_int_t ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data);
-<<<<<<< HEAD
-=======
+ngx_int_t ngx_ssl_session_cache_stat(ngx_ssl_t *ssl,
+    ngx_ssl_cache_stat_t *stat);
+ngx_int_t ngx_ssl_session_cache_file(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_str_t *file, ngx_str_t *key);
+void ngx_ssl_session_cache_save(ngx_cycle_t *cycle);
+ngx_int_t ngx_ssl_verify_cache(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_shm_zone_t *shm_zone, time_t timeout);
+ngx_int_t ngx_ssl_verify_cache_init(ngx_shm_zone_t *shm_zone, void *data);
 ngx_int_t ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl,
-        ngx_array_t *paths);
->>>>>>> nginx-1.5
+    ngx_array_t *paths);
 void ngx_ssl_remove_cached_session(ngx_ssl_t *ssl, ngx_ssl_session_t *sess);
 ngx_int_t ngx_ssl_set_session(ngx_connection_t *c, ngx_ssl_session_t *session);
 ngx_ssl_session_t *ngx_ssl_get_session(ngx_connection_t *c);
@@ -165,6 +385,10 @@ ngx_int_t ngx_ssl_get_cipher_name(ngx_connection_t *c, ngx_pool_t *pool,
     ngx_str_t *s);
 ngx_int_t ngx_ssl_get_session_id(ngx_connection_t *c, ngx_pool_t *pool,
     ngx_str_t *s);
+ngx_int_t ngx_ssl_get_session_reused(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s);
+ngx_int_t ngx_ssl_get_handshake_time(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s);
 ngx_int_t ngx_ssl_get_raw_certificate(ngx_connection_t *c, ngx_pool_t *pool,
     ngx_str_t *s);
 ngx_int_t ngx_ssl_get_certificate(ngx_connection_t *c, ngx_pool_t *pool,
@@ -194,4 +418,7 @@ void ngx_cdecl ngx_ssl_error(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
 void ngx_ssl_cleanup_ctx(void *data);
 
 
+extern ngx_module_t  ngx_polarssl_module;
+
+
 #endif /* _NGX_EVENT_POLARSSL_H_INCLUDED_ */
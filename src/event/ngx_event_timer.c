@@ -15,6 +15,17 @@ ngx_mutex_t  *ngx_event_timer_mutex;
 #endif
 
 
+#if (NGX_TIMER_WHEEL)
+
+static void ngx_event_timer_wheel_advance(void);
+static void ngx_event_timer_wheel_cascade(ngx_uint_t n);
+static ngx_uint_t ngx_event_timer_wheel_next(ngx_uint_t from, ngx_uint_t to);
+
+
+ngx_event_timer_wheel_t  ngx_event_timer_wheel;
+
+#else
+
 ngx_thread_volatile ngx_rbtree_t  ngx_event_timer_rbtree;
 static ngx_rbtree_node_t          ngx_event_timer_sentinel;
 
@@ -24,12 +35,39 @@ static ngx_rbtree_node_t          ngx_event_timer_sentinel;
  * a minimum timer value only
  */
 
+#endif
+
+
 ngx_int_t
 ngx_event_timer_init(ngx_log_t *log)
 {
+#if (NGX_TIMER_WHEEL)
+
+    ngx_uint_t                i;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel;
+
+    ngx_memzero(w->occupied, sizeof(w->occupied));
+
+    w->current = ngx_current_msec;
+    w->count = 0;
+
+    w->expired.left = &w->expired;
+    w->expired.right = &w->expired;
+
+    for (i = 0; i < NGX_TIMER_WHEEL_NSLOTS; i++) {
+        w->slots[i].left = &w->slots[i];
+        w->slots[i].right = &w->slots[i];
+    }
+
+#else
+
     ngx_rbtree_init(&ngx_event_timer_rbtree, &ngx_event_timer_sentinel,
                     ngx_rbtree_insert_timer_value);
 
+#endif
+
 #if (NGX_THREADS)
 
     if (ngx_event_timer_mutex) {
@@ -48,6 +86,8 @@ ngx_event_timer_init(ngx_log_t *log)
 }
 
 
+#if !(NGX_TIMER_WHEEL)
+
 ngx_msec_t
 ngx_event_find_timer(void)
 {
@@ -156,3 +196,420 @@ ngx_event_expire_timers(void)
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 }
+
+#else
+
+
+void
+ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t                n, level, shift;
+    ngx_msec_t                key, delta;
+    ngx_rbtree_node_t        *head;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel;
+
+    key = node->key;
+    delta = key - w->current;
+
+    if ((ngx_msec_int_t) delta < 0) {
+
+        /* the timer has expired already */
+
+        head = &w->expired;
+        goto insert;
+    }
+
+    if (delta < NGX_TIMER_WHEEL_SLOTS0) {
+        n = key & (NGX_TIMER_WHEEL_SLOTS0 - 1);
+        goto slot;
+    }
+
+    n = NGX_TIMER_WHEEL_SLOTS0;
+    shift = NGX_TIMER_WHEEL_BITS0;
+
+    for (level = 1; level < NGX_TIMER_WHEEL_LEVELS - 1; level++) {
+
+        if ((delta >> (shift + NGX_TIMER_WHEEL_BITS)) == 0) {
+            break;
+        }
+
+        n += NGX_TIMER_WHEEL_SLOTS;
+        shift += NGX_TIMER_WHEEL_BITS;
+    }
+
+    if ((delta >> shift) >= NGX_TIMER_WHEEL_SLOTS) {
+
+        /*
+         * the timer is beyond the last level span, it is placed
+         * in the farthest slot and is moved there again on cascading
+         */
+
+        key = w->current + ((ngx_msec_t) (NGX_TIMER_WHEEL_SLOTS - 1) << shift);
+    }
+
+    n += (key >> shift) & (NGX_TIMER_WHEEL_SLOTS - 1);
+
+slot:
+
+    head = &w->slots[n];
+    w->occupied[n / 64] |= (uint64_t) 1 << (n % 64);
+
+insert:
+
+    node->parent = head;
+    node->left = head->left;
+    node->right = head;
+    head->left->right = node;
+    head->left = node;
+
+    w->count++;
+}
+
+
+void
+ngx_event_timer_wheel_delete(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t                n;
+    ngx_rbtree_node_t        *head;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel;
+
+    head = node->parent;
+
+    node->left->right = node->right;
+    node->right->left = node->left;
+
+    if (head->right == head && head != &w->expired) {
+        n = head - w->slots;
+        w->occupied[n / 64] &= ~((uint64_t) 1 << (n % 64));
+    }
+
+    w->count--;
+}
+
+
+ngx_msec_t
+ngx_event_find_timer(void)
+{
+    uint64_t                  delta, d, first, mask;
+    ngx_uint_t                n, c, k, base, level, shift;
+    ngx_msec_int_t            timer;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel;
+
+    if (w->count == 0) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    ngx_mutex_lock(ngx_event_timer_mutex);
+
+    if (w->expired.right != &w->expired) {
+        ngx_mutex_unlock(ngx_event_timer_mutex);
+        return 0;
+    }
+
+    /*
+     * the first level slots give the exact expiration time, while
+     * for the next levels the time of the nearest cascading of a nonempty
+     * slot is used, so the timer is never later than the nearest timer
+     */
+
+    delta = (uint64_t) -1;
+
+    c = w->current & (NGX_TIMER_WHEEL_SLOTS0 - 1);
+
+    n = ngx_event_timer_wheel_next(c, NGX_TIMER_WHEEL_SLOTS0);
+
+    if (n < NGX_TIMER_WHEEL_SLOTS0) {
+        delta = n - c;
+
+    } else {
+        n = ngx_event_timer_wheel_next(0, c);
+
+        if (n < c) {
+            delta = NGX_TIMER_WHEEL_SLOTS0 - c + n;
+        }
+    }
+
+    base = NGX_TIMER_WHEEL_SLOTS0;
+    shift = NGX_TIMER_WHEEL_BITS0;
+
+    for (level = 1; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+
+        mask = ((uint64_t) 1 << shift) - 1;
+        first = ((uint64_t) w->current + mask) & ~mask;
+
+        if (first - w->current >= delta) {
+            break;
+        }
+
+        c = (first >> shift) & (NGX_TIMER_WHEEL_SLOTS - 1);
+
+        k = ngx_event_timer_wheel_next(base + c, base + NGX_TIMER_WHEEL_SLOTS);
+
+        if (k < base + NGX_TIMER_WHEEL_SLOTS) {
+            d = k - base - c;
+
+        } else {
+            k = ngx_event_timer_wheel_next(base, base + c);
+            d = (k < base + c) ? NGX_TIMER_WHEEL_SLOTS - c + k - base
+                               : NGX_TIMER_WHEEL_SLOTS;
+        }
+
+        if (d < NGX_TIMER_WHEEL_SLOTS) {
+            d = first - w->current + (d << shift);
+
+            if (d < delta) {
+                delta = d;
+            }
+        }
+
+        base += NGX_TIMER_WHEEL_SLOTS;
+        shift += NGX_TIMER_WHEEL_BITS;
+    }
+
+    timer = (ngx_msec_int_t) (w->current - ngx_current_msec);
+
+    ngx_mutex_unlock(ngx_event_timer_mutex);
+
+    if (delta > NGX_MAX_INT32_VALUE) {
+        delta = NGX_MAX_INT32_VALUE;
+    }
+
+    timer += (ngx_msec_int_t) delta;
+
+    return (ngx_msec_t) (timer > 0 ? timer : 0);
+}
+
+
+void
+ngx_event_expire_timers(void)
+{
+    ngx_event_t              *ev;
+    ngx_rbtree_node_t        *node;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel;
+
+    for ( ;; ) {
+
+        ngx_mutex_lock(ngx_event_timer_mutex);
+
+        node = w->expired.right;
+
+        if (node == &w->expired) {
+
+            if ((ngx_msec_int_t) (ngx_current_msec - w->current) < 0) {
+                break;
+            }
+
+            if (w->count == 0) {
+                w->current = ngx_current_msec + 1;
+                break;
+            }
+
+            ngx_event_timer_wheel_advance();
+
+            ngx_mutex_unlock(ngx_event_timer_mutex);
+
+            continue;
+        }
+
+        ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+#if (NGX_THREADS)
+
+        if (ngx_threaded && ngx_trylock(ev->lock) == 0) {
+
+            /*
+             * We cannot change the timer of the event that is being
+             * handled by another thread, so we exit the loop.
+             * However, it should be a rare case when the event that is
+             * being handled has an expired timer.
+             */
+
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "event %p is busy in expire timers", ev);
+            break;
+        }
+#endif
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "event timer del: %d: %M",
+                       ngx_event_ident(ev->data), ev->timer.key);
+
+        ngx_event_timer_wheel_delete(&ev->timer);
+
+        ngx_mutex_unlock(ngx_event_timer_mutex);
+
+#if (NGX_DEBUG)
+        ev->timer.left = NULL;
+        ev->timer.right = NULL;
+        ev->timer.parent = NULL;
+#endif
+
+        ev->timer_set = 0;
+
+#if (NGX_THREADS)
+        if (ngx_threaded) {
+            ev->posted_timedout = 1;
+
+            ngx_post_event(ev, &ngx_posted_events);
+
+            ngx_unlock(ev->lock);
+
+            continue;
+        }
+#endif
+
+        ev->timedout = 1;
+
+        ev->handler(ev);
+    }
+
+    ngx_mutex_unlock(ngx_event_timer_mutex);
+}
+
+
+static void
+ngx_event_timer_wheel_advance(void)
+{
+    ngx_uint_t                n, i, level, shift;
+    ngx_msec_t                next;
+    ngx_rbtree_node_t        *head, *node;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel;
+
+    n = w->current & (NGX_TIMER_WHEEL_SLOTS0 - 1);
+
+    if (n == 0) {
+
+        /* move the timers of the next levels slots down */
+
+        shift = NGX_TIMER_WHEEL_BITS0;
+
+        for (level = 1; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+            i = (w->current >> shift) & (NGX_TIMER_WHEEL_SLOTS - 1);
+
+            ngx_event_timer_wheel_cascade(NGX_TIMER_WHEEL_SLOTS0
+                                          + (level - 1) * NGX_TIMER_WHEEL_SLOTS
+                                          + i);
+            if (i) {
+                break;
+            }
+
+            shift += NGX_TIMER_WHEEL_BITS;
+        }
+    }
+
+    head = &w->slots[n];
+
+    if (head->right != head) {
+
+        /* the timers of the current millisecond have expired */
+
+        for (node = head->right; node != head; node = node->right) {
+            node->parent = &w->expired;
+        }
+
+        head->right->left = w->expired.left;
+        w->expired.left->right = head->right;
+        head->left->right = &w->expired;
+        w->expired.left = head->left;
+
+        head->left = head;
+        head->right = head;
+
+        w->occupied[n / 64] &= ~((uint64_t) 1 << (n % 64));
+
+        w->current++;
+
+        return;
+    }
+
+    if (ngx_event_timer_wheel_next(0, NGX_TIMER_WHEEL_SLOTS0)
+        < NGX_TIMER_WHEEL_SLOTS0)
+    {
+        w->current++;
+        return;
+    }
+
+    /*
+     * the first level is empty, skip to its next turn, but not later
+     * than the current time to keep the expired timers in their list
+     */
+
+    next = (w->current | (NGX_TIMER_WHEEL_SLOTS0 - 1)) + 1;
+
+    if ((ngx_msec_int_t) (next - ngx_current_msec) > 1) {
+        next = ngx_current_msec + 1;
+    }
+
+    w->current = next;
+}
+
+
+static void
+ngx_event_timer_wheel_cascade(ngx_uint_t n)
+{
+    ngx_rbtree_node_t        *head, *node, *next;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel;
+
+    head = &w->slots[n];
+
+    if (head->right == head) {
+        return;
+    }
+
+    node = head->right;
+
+    head->left = head;
+    head->right = head;
+
+    w->occupied[n / 64] &= ~((uint64_t) 1 << (n % 64));
+
+    while (node != head) {
+        next = node->right;
+
+        w->count--;
+        ngx_event_timer_wheel_insert(node);
+
+        node = next;
+    }
+}
+
+
+static ngx_uint_t
+ngx_event_timer_wheel_next(ngx_uint_t from, ngx_uint_t to)
+{
+    uint64_t  bits;
+
+    /* the first occupied slot in [from, to), or "to" */
+
+    while (from < to) {
+        bits = ngx_event_timer_wheel.occupied[from / 64] >> (from % 64);
+
+        if (bits == 0) {
+            from = (from | 63) + 1;
+            continue;
+        }
+
+        while ((bits & 1) == 0) {
+            bits >>= 1;
+            from++;
+        }
+
+        break;
+    }
+
+    return ngx_min(from, to);
+}
+
+#endif
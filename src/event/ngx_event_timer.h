@@ -19,6 +19,49 @@
 #define NGX_TIMER_LAZY_DELAY  300
 
 
+#if (NGX_TIMER_WHEEL)
+
+/*
+ * The hierarchical timer wheel: the first level has 256 slots
+ * of 1 millisecond, and each of the next four levels has 64 slots
+ * of the whole previous level span.  The timer rbtree nodes are linked
+ * in the slot lists by the left (previous) and right (next) pointers,
+ * and the parent pointer refers to the slot list head.
+ */
+
+#define NGX_TIMER_WHEEL_BITS0    8
+#define NGX_TIMER_WHEEL_BITS     6
+#define NGX_TIMER_WHEEL_LEVELS   5
+
+#define NGX_TIMER_WHEEL_SLOTS0   (1 << NGX_TIMER_WHEEL_BITS0)
+#define NGX_TIMER_WHEEL_SLOTS    (1 << NGX_TIMER_WHEEL_BITS)
+#define NGX_TIMER_WHEEL_NSLOTS                                                \
+    (NGX_TIMER_WHEEL_SLOTS0                                                   \
+     + (NGX_TIMER_WHEEL_LEVELS - 1) * NGX_TIMER_WHEEL_SLOTS)
+
+
+typedef struct {
+    ngx_msec_t          current;
+    ngx_uint_t          count;
+    uint64_t            occupied[NGX_TIMER_WHEEL_NSLOTS / 64];
+    ngx_rbtree_node_t   expired;
+    ngx_rbtree_node_t   slots[NGX_TIMER_WHEEL_NSLOTS];
+} ngx_event_timer_wheel_t;
+
+
+void ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node);
+void ngx_event_timer_wheel_delete(ngx_rbtree_node_t *node);
+
+#define ngx_event_timer_empty()  (ngx_event_timer_wheel.count == 0)
+
+#else
+
+#define ngx_event_timer_empty()                                               \
+    (ngx_event_timer_rbtree.root == ngx_event_timer_rbtree.sentinel)
+
+#endif
+
+
 ngx_int_t ngx_event_timer_init(ngx_log_t *log);
 ngx_msec_t ngx_event_find_timer(void);
 void ngx_event_expire_timers(void);
@@ -29,7 +72,11 @@ extern ngx_mutex_t  *ngx_event_timer_mutex;
 #endif
 
 
+#if (NGX_TIMER_WHEEL)
+extern ngx_event_timer_wheel_t           ngx_event_timer_wheel;
+#else
 extern ngx_thread_volatile ngx_rbtree_t  ngx_event_timer_rbtree;
+#endif
 
 
 static ngx_inline void
@@ -41,7 +88,11 @@ ngx_event_del_timer(ngx_event_t *ev)
 
     ngx_mutex_lock(ngx_event_timer_mutex);
 
+#if (NGX_TIMER_WHEEL)
+    ngx_event_timer_wheel_delete(&ev->timer);
+#else
     ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+#endif
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 
@@ -91,7 +142,11 @@ ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer)
 
     ngx_mutex_lock(ngx_event_timer_mutex);
 
+#if (NGX_TIMER_WHEEL)
+    ngx_event_timer_wheel_insert(&ev->timer);
+#else
     ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+#endif
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 
@@ -28,12 +28,29 @@ typedef struct {
 
     size_t                          buffer_size;
 
+#if (NGX_POLARSSL)
+    ngx_flag_t                      dyn_rec_enable;
+    ngx_msec_t                      dyn_rec_timeout;
+    size_t                          dyn_rec_size_lo;
+    ngx_uint_t                      dyn_rec_threshold;
+#if (NGX_THREAD_POOL)
+    ngx_thread_pool_t              *thread_pool;
+#endif
+#if (NGX_HAVE_KTLS)
+    ngx_flag_t                      ktls;
+#endif
+    ngx_str_t                       session_cache_file;
+    ngx_str_t                       session_cache_key;
+    ngx_shm_zone_t                 *verify_cache;
+    time_t                          verify_cache_timeout;
+#endif
+
     ssize_t                         builtin_session_cache;
 
     time_t                          session_timeout;
 
-    ngx_str_t                       certificate;
-    ngx_str_t                       certificate_key;
+    ngx_array_t                    *certificates;
+    ngx_array_t                    *certificate_keys;
     ngx_str_t                       dhparam;
     ngx_str_t                       ecdh_curve;
     ngx_str_t                       client_certificate;
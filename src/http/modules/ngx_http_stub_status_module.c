@@ -10,19 +10,49 @@
 #include <ngx_http.h>
 
 
+#define NGX_HTTP_STUB_STATUS_SSL         0x0001
+#define NGX_HTTP_STUB_STATUS_POOL_CACHE  0x0002
+#define NGX_HTTP_STUB_STATUS_ZONES       0x0004
+
+
+typedef struct {
+    ngx_uint_t                 sections;    /* of all stub_status locations */
+    ngx_array_t                ssl_servers; /* ngx_ssl_t * */
+    ngx_atomic_t              *ssl_stat;
+} ngx_http_stub_status_main_conf_t;
+
+
+typedef struct {
+    ngx_uint_t                 sections;
+} ngx_http_stub_status_loc_conf_t;
+
+
 static ngx_int_t ngx_http_stub_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_stub_status_add_variables(ngx_conf_t *cf);
-
+static size_t ngx_http_stub_status_zones_size(void);
+static u_char *ngx_http_stub_status_zones(u_char *p);
+#if (NGX_POLARSSL)
+static size_t ngx_http_stub_status_ssl_size(ngx_http_request_t *r);
+static u_char *ngx_http_stub_status_ssl(ngx_http_request_t *r, u_char *p);
+#if (NGX_HTTP_SSL)
+static ngx_int_t ngx_http_stub_status_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+#endif
+#endif
+
+static void *ngx_http_stub_status_create_main_conf(ngx_conf_t *cf);
+static void *ngx_http_stub_status_create_loc_conf(ngx_conf_t *cf);
+static ngx_int_t ngx_http_stub_status_init(ngx_conf_t *cf);
 static char *ngx_http_set_status(ngx_conf_t *cf, ngx_command_t *cmd,
                                  void *conf);
 
 static ngx_command_t  ngx_http_status_commands[] = {
 
     { ngx_string("stub_status"),
-      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
       ngx_http_set_status,
-      0,
+      NGX_HTTP_LOC_CONF_OFFSET,
       0,
       NULL },
 
@@ -33,15 +63,15 @@ static ngx_command_t  ngx_http_status_commands[] = {
 
 static ngx_http_module_t  ngx_http_stub_status_module_ctx = {
     ngx_http_stub_status_add_variables,    /* preconfiguration */
-    NULL,                                  /* postconfiguration */
+    ngx_http_stub_status_init,             /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
+    ngx_http_stub_status_create_main_conf, /* create main configuration */
     NULL,                                  /* init main configuration */
 
     NULL,                                  /* create server configuration */
     NULL,                                  /* merge server configuration */
 
-    NULL,                                  /* create location configuration */
+    ngx_http_stub_status_create_loc_conf,  /* create location configuration */
     NULL                                   /* merge location configuration */
 };
 
@@ -76,17 +106,40 @@ static ngx_http_variable_t  ngx_http_stub_status_vars[] = {
     { ngx_string("connections_waiting"), NULL, ngx_http_stub_status_variable,
       3, NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+#if (NGX_POLARSSL)
+
+    { ngx_string("ssl_handshakes"), NULL, ngx_http_stub_status_variable,
+      4, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("ssl_handshakes_reused"), NULL, ngx_http_stub_status_variable,
+      5, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("ssl_handshakes_failed"), NULL, ngx_http_stub_status_variable,
+      6, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+#endif
+
+    { ngx_string("pool_cache_hits"), NULL, ngx_http_stub_status_variable,
+      7, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("pool_cache_misses"), NULL, ngx_http_stub_status_variable,
+      8, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("pool_cache_size"), NULL, ngx_http_stub_status_variable,
+      9, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
     { ngx_null_string, NULL, NULL, 0, 0, 0 }
 };
 
 
 static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r)
 {
-    size_t             size;
-    ngx_int_t          rc;
-    ngx_buf_t         *b;
-    ngx_chain_t        out;
-    ngx_atomic_int_t   ap, hn, ac, rq, rd, wr, wa;
+    size_t                            size;
+    ngx_int_t                         rc;
+    ngx_buf_t                        *b;
+    ngx_chain_t                       out;
+    ngx_atomic_int_t                  ap, hn, ac, rq, rd, wr, wa;
+    ngx_http_stub_status_loc_conf_t  *slcf;
 
     if (r->method != NGX_HTTP_GET && r->method != NGX_HTTP_HEAD) {
         return NGX_HTTP_NOT_ALLOWED;
@@ -117,6 +170,23 @@ static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r)
            + 6 + 3 * NGX_ATOMIC_T_LEN
            + sizeof("Reading:  Writing:  Waiting:  \n") + 3 * NGX_ATOMIC_T_LEN;
 
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_stub_status_module);
+
+    if (slcf->sections & NGX_HTTP_STUB_STATUS_ZONES) {
+        size += ngx_http_stub_status_zones_size();
+    }
+
+    if (slcf->sections & NGX_HTTP_STUB_STATUS_POOL_CACHE) {
+        size += sizeof("Pool cache worker hits misses overflows size\n") - 1
+                + 6 + NGX_INT64_LEN + 4 * NGX_INT_T_LEN;
+    }
+
+#if (NGX_POLARSSL)
+    if (slcf->sections & NGX_HTTP_STUB_STATUS_SSL) {
+        size += ngx_http_stub_status_ssl_size(r);
+    }
+#endif
+
     b = ngx_create_temp_buf(r->pool, size);
     if (b == NULL) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
@@ -143,6 +213,31 @@ static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r)
     b->last = ngx_sprintf(b->last, "Reading: %uA Writing: %uA Waiting: %uA \n",
                           rd, wr, wa);
 
+    if (slcf->sections & NGX_HTTP_STUB_STATUS_POOL_CACHE) {
+
+        /* the pool cache is per worker, so are its counters */
+
+        b->last = ngx_cpymem(b->last,
+                             "Pool cache worker hits misses overflows size\n",
+                             sizeof("Pool cache worker hits misses overflows"
+                                    " size\n") - 1);
+
+        b->last = ngx_sprintf(b->last, " %P %ui %ui %ui %uz \n",
+                              ngx_pid, ngx_pool_cache.hits,
+                              ngx_pool_cache.misses, ngx_pool_cache.overflows,
+                              ngx_pool_cache.size);
+    }
+
+    if (slcf->sections & NGX_HTTP_STUB_STATUS_ZONES) {
+        b->last = ngx_http_stub_status_zones(b->last);
+    }
+
+#if (NGX_POLARSSL)
+    if (slcf->sections & NGX_HTTP_STUB_STATUS_SSL) {
+        b->last = ngx_http_stub_status_ssl(r, b->last);
+    }
+#endif
+
     r->headers_out.status = NGX_HTTP_OK;
     r->headers_out.content_length_n = b->last - b->pos;
 
@@ -159,6 +254,261 @@ static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r)
 }
 
 
+static size_t
+ngx_http_stub_status_zones_size(void)
+{
+    size_t            size;
+    ngx_uint_t        i, n;
+    ngx_shm_zone_t   *shm_zone;
+    ngx_list_part_t  *part;
+
+    size = 0;
+    n = ngx_pagesize_shift;
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        size += sizeof("Zone : free pages  \n") - 1 + shm_zone[i].shm.name.len
+                + NGX_INT_T_LEN
+                + sizeof(" size used total reqs fails\n") - 1
+                + n * (6 + 5 * NGX_INT_T_LEN);
+    }
+
+    return size;
+}
+
+
+static u_char *
+ngx_http_stub_status_zones(u_char *p)
+{
+    ngx_uint_t        i, n, slot;
+    ngx_shm_zone_t   *shm_zone;
+    ngx_slab_pool_t  *sp;
+    ngx_slab_stat_t  *st;
+    ngx_list_part_t  *part;
+
+    /* the counters are read without the zone locks */
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        sp = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
+
+        p = ngx_sprintf(p, "Zone %V: free pages %ui \n",
+                        &shm_zone[i].shm.name, sp->pfree);
+
+        p = ngx_cpymem(p, " size used total reqs fails\n",
+                       sizeof(" size used total reqs fails\n") - 1);
+
+        n = ngx_pagesize_shift - sp->min_shift;
+
+        for (slot = 0; slot < n; slot++) {
+            st = &sp->stats[slot];
+
+            if (st->reqs == 0) {
+                continue;
+            }
+
+            p = ngx_sprintf(p, " %uz %ui %ui %ui %ui \n",
+                            sp->min_size << slot, st->used, st->total,
+                            st->reqs, st->fails);
+        }
+    }
+
+    return p;
+}
+
+
+#if (NGX_POLARSSL)
+
+static size_t
+ngx_http_stub_status_ssl_size(ngx_http_request_t *r)
+{
+    size_t                              size;
+#if (NGX_HTTP_SSL)
+    ngx_uint_t                          n;
+    ngx_http_ssl_srv_conf_t            *sscf;
+    ngx_http_core_srv_conf_t          **cscfp;
+    ngx_http_core_main_conf_t          *cmcf;
+#endif
+
+    size = sizeof("SSL handshakes reused_cache reused_tickets failed\n") - 1
+           + 5 + 4 * NGX_ATOMIC_T_LEN
+           + sizeof("SSL handshake_msec under_1ms under_10ms under_100ms"
+                    " slower\n") - 1
+           + 6 + 5 * NGX_ATOMIC_T_LEN
+           + sizeof("SSL failed error count\n") - 1
+           + NGX_SSL_STAT_CODES * (sizeof(" -0x0000  \n") - 1
+                                   + NGX_ATOMIC_T_LEN)
+           + sizeof("SSL session_cache sessions hits misses evictions\n")
+           - 1 + 5 + 4 * NGX_INT_T_LEN;
+
+#if (NGX_HTTP_SSL)
+
+    size += sizeof("SSL server name handshakes reused_cache reused_tickets"
+                   " failed\n") - 1;
+
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+    cscfp = cmcf->servers.elts;
+
+    for (n = 0; n < cmcf->servers.nelts; n++) {
+        sscf = cscfp[n]->ctx->srv_conf[ngx_http_ssl_module.ctx_index];
+
+        if (sscf->ssl.stat) {
+            size += sizeof("\"\"") - 1 + cscfp[n]->server_name.len
+                    + 6 + 4 * NGX_ATOMIC_T_LEN;
+        }
+    }
+
+#endif
+
+    return size;
+}
+
+
+static u_char *
+ngx_http_stub_status_ssl(ngx_http_request_t *r, u_char *p)
+{
+    ngx_int_t                          cache;
+    ngx_uint_t                         n;
+    ngx_atomic_t                      *st;
+    ngx_ssl_cache_stat_t               cs;
+#if (NGX_HTTP_SSL)
+    ngx_str_t                         *name;
+    ngx_http_ssl_srv_conf_t           *sscf;
+    ngx_http_core_srv_conf_t         **cscfp;
+    ngx_http_core_main_conf_t         *cmcf;
+#endif
+
+    st = ngx_stat_ssl;
+
+    p = ngx_cpymem(p, "SSL handshakes reused_cache reused_tickets failed\n",
+                   sizeof("SSL handshakes reused_cache reused_tickets"
+                          " failed\n") - 1);
+
+    p = ngx_sprintf(p, " %uA %uA %uA %uA \n",
+                    st[NGX_SSL_STAT_HANDSHAKES],
+                    st[NGX_SSL_STAT_REUSED_CACHE],
+                    st[NGX_SSL_STAT_REUSED_TICKET],
+                    st[NGX_SSL_STAT_FAILED]);
+
+    p = ngx_cpymem(p, "SSL handshake_msec under_1ms under_10ms under_100ms"
+                      " slower\n",
+                   sizeof("SSL handshake_msec under_1ms under_10ms"
+                          " under_100ms slower\n") - 1);
+
+    p = ngx_sprintf(p, " %uA %uA %uA %uA %uA \n",
+                    st[NGX_SSL_STAT_TIME] / 1000,
+                    st[NGX_SSL_STAT_TIME_1MS],
+                    st[NGX_SSL_STAT_TIME_10MS],
+                    st[NGX_SSL_STAT_TIME_100MS],
+                    st[NGX_SSL_STAT_TIME_SLOW]);
+
+    /* the failures by the high-level part of the PolarSSL error code */
+
+    p = ngx_cpymem(p, "SSL failed error count\n",
+                   sizeof("SSL failed error count\n") - 1);
+
+    for (n = 0; n < NGX_SSL_STAT_CODES; n++) {
+
+        if (st[NGX_SSL_STAT_FAILED_CODE + n] == 0) {
+            continue;
+        }
+
+        if (n == 0) {
+            p = ngx_sprintf(p, " other %uA \n", st[NGX_SSL_STAT_FAILED_CODE]);
+
+        } else {
+            p = ngx_sprintf(p, " -0x%04xi %uA \n",
+                            n << 7, st[NGX_SSL_STAT_FAILED_CODE + n]);
+        }
+    }
+
+    cache = NGX_DECLINED;
+
+#if (NGX_HTTP_SSL)
+
+    /* the session cache is the one of the server the status is asked from */
+
+    sscf = ngx_http_get_module_srv_conf(r, ngx_http_ssl_module);
+    cache = ngx_ssl_session_cache_stat(&sscf->ssl, &cs);
+
+#endif
+
+    if (cache == NGX_OK) {
+        p = ngx_cpymem(p, "SSL session_cache sessions hits misses evictions\n",
+                       sizeof("SSL session_cache sessions hits misses"
+                              " evictions\n") - 1);
+
+        p = ngx_sprintf(p, " %ui %ui %ui %ui \n",
+                        cs.sessions, cs.hits, cs.misses, cs.evictions);
+    }
+
+#if (NGX_HTTP_SSL)
+
+    p = ngx_cpymem(p, "SSL server name handshakes reused_cache reused_tickets"
+                      " failed\n",
+                   sizeof("SSL server name handshakes reused_cache"
+                          " reused_tickets failed\n") - 1);
+
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+    cscfp = cmcf->servers.elts;
+
+    for (n = 0; n < cmcf->servers.nelts; n++) {
+        sscf = cscfp[n]->ctx->srv_conf[ngx_http_ssl_module.ctx_index];
+
+        st = sscf->ssl.stat;
+
+        if (st == NULL) {
+            continue;
+        }
+
+        name = &cscfp[n]->server_name;
+
+        if (name->len == 0) {
+            p = ngx_cpymem(p, " \"\"", sizeof(" \"\"") - 1);
+
+        } else {
+            p = ngx_sprintf(p, " %V", name);
+        }
+
+        p = ngx_sprintf(p, " %uA %uA %uA %uA \n",
+                        st[NGX_SSL_STAT_HANDSHAKES],
+                        st[NGX_SSL_STAT_REUSED_CACHE],
+                        st[NGX_SSL_STAT_REUSED_TICKET],
+                        st[NGX_SSL_STAT_FAILED]);
+    }
+
+#endif
+
+    return p;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_stub_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
@@ -188,6 +538,35 @@ ngx_http_stub_status_variable(ngx_http_request_t *r,
         value = *ngx_stat_waiting;
         break;
 
+#if (NGX_POLARSSL)
+
+    case 4:
+        value = ngx_stat_ssl[NGX_SSL_STAT_HANDSHAKES];
+        break;
+
+    case 5:
+        value = ngx_stat_ssl[NGX_SSL_STAT_REUSED_CACHE]
+                + ngx_stat_ssl[NGX_SSL_STAT_REUSED_TICKET];
+        break;
+
+    case 6:
+        value = ngx_stat_ssl[NGX_SSL_STAT_FAILED];
+        break;
+
+#endif
+
+    case 7:
+        value = ngx_pool_cache.hits;
+        break;
+
+    case 8:
+        value = ngx_pool_cache.misses;
+        break;
+
+    case 9:
+        value = ngx_pool_cache.size;
+        break;
+
     /* suppress warning */
     default:
         value = 0;
@@ -223,9 +602,221 @@ ngx_http_stub_status_add_variables(ngx_conf_t *cf)
 }
 
 
-static char *ngx_http_set_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+static void *
+ngx_http_stub_status_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_stub_status_main_conf_t  *smcf;
+
+    smcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_stub_status_main_conf_t));
+    if (smcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     smcf->sections = 0;
+     *     smcf->ssl_servers = { NULL };
+     *     smcf->ssl_stat = NULL;
+     */
+
+    return smcf;
+}
+
+
+static void *
+ngx_http_stub_status_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_stub_status_loc_conf_t  *slcf;
+
+    slcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_stub_status_loc_conf_t));
+    if (slcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     slcf->sections = 0;
+     */
+
+    return slcf;
+}
+
+
+static ngx_int_t
+ngx_http_stub_status_init(ngx_conf_t *cf)
+{
+#if (NGX_POLARSSL && NGX_HTTP_SSL)
+    size_t                              size;
+    ngx_str_t                           name;
+    ngx_uint_t                          n;
+    ngx_ssl_t                         **sslp;
+    ngx_shm_zone_t                     *shm_zone;
+    ngx_http_ssl_srv_conf_t            *sscf;
+    ngx_http_core_srv_conf_t          **cscfp;
+    ngx_http_core_main_conf_t          *cmcf;
+    ngx_http_stub_status_main_conf_t   *smcf;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_stub_status_module);
+
+    if (!(smcf->sections & NGX_HTTP_STUB_STATUS_SSL)) {
+        return NGX_OK;
+    }
+
+    /*
+     * the handshake counters of each SSL server are kept in a zone of
+     * their own, ngx_stat_ssl is allocated once and cannot grow on reload
+     */
+
+    if (ngx_array_init(&smcf->ssl_servers, cf->pool, 4, sizeof(ngx_ssl_t *))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+    cscfp = cmcf->servers.elts;
+
+    for (n = 0; n < cmcf->servers.nelts; n++) {
+        sscf = cscfp[n]->ctx->srv_conf[ngx_http_ssl_module.ctx_index];
+
+        if (sscf->ssl.ctx == NULL) {
+            continue;
+        }
+
+        sslp = ngx_array_push(&smcf->ssl_servers);
+        if (sslp == NULL) {
+            return NGX_ERROR;
+        }
+
+        *sslp = &sscf->ssl;
+    }
+
+    if (smcf->ssl_servers.nelts == 0) {
+        return NGX_OK;
+    }
+
+    size = 8 * ngx_pagesize
+           + ngx_align(smcf->ssl_servers.nelts * NGX_SSL_SERVER_STAT_N
+                       * sizeof(ngx_atomic_t), ngx_pagesize);
+
+    ngx_str_set(&name, "stub_status_ssl");
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_stub_status_module);
+    if (shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    shm_zone->init = ngx_http_stub_status_init_zone;
+    shm_zone->data = smcf;
+#endif
+
+    return NGX_OK;
+}
+
+
+#if (NGX_POLARSSL && NGX_HTTP_SSL)
+
+static ngx_int_t
+ngx_http_stub_status_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 {
-    ngx_http_core_loc_conf_t  *clcf;
+    ngx_http_stub_status_main_conf_t  *osmcf = data;
+
+    size_t                             size;
+    ngx_uint_t                         n;
+    ngx_ssl_t                        **sslp;
+    ngx_slab_pool_t                   *shpool;
+    ngx_http_stub_status_main_conf_t  *smcf;
+
+    smcf = shm_zone->data;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    /* the counters are kept over a reload if the number of servers is */
+
+    if (osmcf && osmcf->ssl_servers.nelts == smcf->ssl_servers.nelts) {
+        smcf->ssl_stat = osmcf->ssl_stat;
+
+    } else {
+
+        if (osmcf) {
+            ngx_slab_free(shpool, (void *) osmcf->ssl_stat);
+        }
+
+        size = smcf->ssl_servers.nelts * NGX_SSL_SERVER_STAT_N
+               * sizeof(ngx_atomic_t);
+
+        smcf->ssl_stat = ngx_slab_alloc(shpool, size);
+        if (smcf->ssl_stat == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memzero((void *) smcf->ssl_stat, size);
+    }
+
+    sslp = smcf->ssl_servers.elts;
+
+    for (n = 0; n < smcf->ssl_servers.nelts; n++) {
+        sslp[n]->stat = smcf->ssl_stat + n * NGX_SSL_SERVER_STAT_N;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static char *
+ngx_http_set_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_stub_status_loc_conf_t *slcf = conf;
+
+    ngx_str_t                         *value;
+    ngx_uint_t                         i;
+    ngx_http_core_loc_conf_t          *clcf;
+    ngx_http_stub_status_main_conf_t  *smcf;
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        /* "on" and "off" are accepted as before, both enable the status */
+
+        if (ngx_strcmp(value[i].data, "on") == 0
+            || ngx_strcmp(value[i].data, "off") == 0)
+        {
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "ssl") == 0) {
+#if (NGX_POLARSSL)
+            slcf->sections |= NGX_HTTP_STUB_STATUS_SSL;
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "the \"ssl\" parameter requires PolarSSL");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+        if (ngx_strcmp(value[i].data, "pool_cache") == 0) {
+            slcf->sections |= NGX_HTTP_STUB_STATUS_POOL_CACHE;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "zones") == 0) {
+            slcf->sections |= NGX_HTTP_STUB_STATUS_ZONES;
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    smcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_stub_status_module);
+    smcf->sections |= slcf->sections;
 
     clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
     clcf->handler = ngx_http_status_handler;
@@ -1353,9 +1353,17 @@ ngx_http_add_address(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
      && !defined TLSEXT_TYPE_application_layer_protocol_negotiation           \
      && !defined TLSEXT_TYPE_next_proto_neg)
     if (lsopt->spdy && lsopt->ssl) {
+#if (NGX_POLARSSL)
+#ifndef POLARSSL_SSL_ALPN
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "nginx was built with PolarSSL without ALPN "
+                           "support, SPDY is not enabled for %s", lsopt->addr);
+#endif
+#else
         ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
                            "nginx was built without OpenSSL ALPN or NPN "
                            "support, SPDY is not enabled for %s", lsopt->addr);
+#endif
     }
 #endif
 
@@ -1739,6 +1747,10 @@ ngx_http_init_listening(ngx_conf_t *cf, ngx_http_conf_port_t *port)
             break;
         }
 
+        if (ngx_clone_listening(cf, ls) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
         addr++;
         last--;
     }
@@ -1817,6 +1829,10 @@ ngx_http_add_listening(ngx_conf_t *cf, ngx_http_conf_addr_t *addr)
     ls->fastopen = addr->opt.fastopen;
 #endif
 
+#if (NGX_HAVE_REUSEPORT)
+    ls->reuseport = addr->opt.reuseport;
+#endif
+
     return ls;
 }
 
@@ -28,6 +28,7 @@
 #define NGX_HTTP_AIO_OFF                0
 #define NGX_HTTP_AIO_ON                 1
 #define NGX_HTTP_AIO_SENDFILE           2
+#define NGX_HTTP_AIO_THREADS            3
 
 
 #define NGX_HTTP_SATISFY_ALL            0
@@ -83,6 +84,9 @@ typedef struct {
 #endif
     unsigned                   so_keepalive:2;
     unsigned                   proxy_protocol:1;
+#if (NGX_HAVE_REUSEPORT)
+    unsigned                   reuseport:1;
+#endif
 
     int                        backlog;
     int                        rcvbuf;
@@ -396,8 +400,12 @@ struct ngx_http_core_loc_conf_s {
                                            /* client_body_in_singe_buffer */
     ngx_flag_t    internal;                /* internal */
     ngx_flag_t    sendfile;                /* sendfile */
-#if (NGX_HAVE_FILE_AIO)
+#if (NGX_HAVE_FILE_AIO || NGX_THREAD_POOL)
     ngx_flag_t    aio;                     /* aio */
+#endif
+#if (NGX_THREAD_POOL)
+    ngx_flag_t    aio_write;               /* aio_write */
+    ngx_thread_pool_t  *thread_pool;
 #endif
     ngx_flag_t    tcp_nopush;              /* tcp_nopush */
     ngx_flag_t    tcp_nodelay;             /* tcp_nodelay */
@@ -10,6 +10,10 @@
 #include <ngx_http.h>
 #include <ngx_md5.h>
 
+#if (NGX_THREAD_POOL)
+#include <ngx_thread_pool.h>
+#endif
+
 
 static ngx_int_t ngx_http_file_cache_lock(ngx_http_request_t *r,
     ngx_http_cache_t *c);
@@ -21,6 +25,11 @@ static ssize_t ngx_http_file_cache_aio_read(ngx_http_request_t *r,
 #if (NGX_HAVE_FILE_AIO)
 static void ngx_http_cache_aio_event_handler(ngx_event_t *ev);
 #endif
+#if (NGX_THREAD_POOL)
+static ngx_int_t ngx_http_cache_thread_handler(ngx_thread_task_t *task,
+    ngx_file_t *file);
+static void ngx_http_cache_thread_event_handler(ngx_event_t *ev);
+#endif
 static ngx_int_t ngx_http_file_cache_exists(ngx_http_file_cache_t *cache,
     ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_name(ngx_http_request_t *r,
@@ -574,15 +583,32 @@ ngx_http_file_cache_aio_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
 #if (NGX_HAVE_FILE_AIO)
     ssize_t                    n;
+#endif
+#if (NGX_HAVE_FILE_AIO || NGX_THREAD_POOL)
     ngx_http_core_loc_conf_t  *clcf;
 
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+#endif
+
+#if (NGX_THREAD_POOL)
+
+    if (clcf->aio == NGX_HTTP_AIO_THREADS) {
+        c->file.thread_handler = ngx_http_cache_thread_handler;
+        c->file.thread_ctx = r;
+
+        return ngx_thread_read(&c->file, c->buf->pos, c->body_start, 0,
+                               r->pool);
+    }
+
+#endif
+
+#if (NGX_HAVE_FILE_AIO)
+
     if (!ngx_file_aio) {
         goto noaio;
     }
 
-    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
-
-    if (!clcf->aio) {
+    if (clcf->aio != NGX_HTTP_AIO_ON && clcf->aio != NGX_HTTP_AIO_SENDFILE) {
         goto noaio;
     }
 
@@ -628,6 +654,48 @@ ngx_http_cache_aio_event_handler(ngx_event_t *ev)
 #endif
 
 
+#if (NGX_THREAD_POOL)
+
+static ngx_int_t
+ngx_http_cache_thread_handler(ngx_thread_task_t *task, ngx_file_t *file)
+{
+    ngx_http_request_t        *r;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    r = file->thread_ctx;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    task->event.data = r;
+    task->event.handler = ngx_http_cache_thread_event_handler;
+
+    if (ngx_thread_task_post(clcf->thread_pool, task) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->main->blocked++;
+    r->aio = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_cache_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    r->connection->write->handler(r->connection->write);
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 {
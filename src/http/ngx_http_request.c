@@ -64,6 +64,28 @@ static void ngx_http_ssl_handshake_handler(ngx_connection_t *c);
 #endif
 
 
+#if (NGX_HTTP_SSL && NGX_POLARSSL && defined POLARSSL_SSL_ALPN)
+
+/* PolarSSL keeps the pointer, the lists are in the server's preference order */
+
+static const char  *ngx_http_ssl_alpn_protocols[] = {
+    "http/1.1",
+    NULL
+};
+
+#if (NGX_HTTP_SPDY)
+
+static const char  *ngx_http_ssl_alpn_spdy_protocols[] = {
+    NGX_SPDY_NPN_NEGOTIATED,
+    "http/1.1",
+    NULL
+};
+
+#endif
+
+#endif
+
+
 static char *ngx_http_client_errors[] = {
 
     /* NGX_HTTP_PARSE_INVALID_METHOD */
@@ -571,7 +593,7 @@ ngx_http_create_request(ngx_connection_t *c)
     }
 
 #if (NGX_HTTP_SSL)
-    if (c->ssl) {
+    if (c->ssl && !c->ssl->sendfile) {
         r->main_filter_need_in_memory = 1;
     }
 #endif
@@ -714,6 +736,29 @@ ngx_http_ssl_handshake(ngx_event_t *rev)
                 return;
             }
 
+#if (NGX_POLARSSL && defined POLARSSL_SSL_ALPN)
+
+            {
+            const char  **protos;
+
+#if (NGX_HTTP_SPDY)
+            if (hc->addr_conf->spdy) {
+                protos = ngx_http_ssl_alpn_spdy_protocols;
+
+            } else
+#endif
+            {
+                protos = ngx_http_ssl_alpn_protocols;
+            }
+
+            if (ssl_set_alpn_protocols(c->ssl->connection, protos) != 0) {
+                ngx_http_close_connection(c);
+                return;
+            }
+            }
+
+#endif
+
             rc = ngx_ssl_handshake(c);
 
             if (rc == NGX_AGAIN) {
@@ -791,6 +836,22 @@ ngx_http_ssl_handshake_handler(ngx_connection_t *c)
         }
 #endif
 
+#if (NGX_HTTP_SPDY && NGX_POLARSSL && defined POLARSSL_SSL_ALPN)
+        {
+        const char  *proto;
+
+        proto = ssl_get_alpn_protocol(c->ssl->connection);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "SSL ALPN selected: %s", proto ? proto : "none");
+
+        if (proto && ngx_strcmp(proto, NGX_SPDY_NPN_NEGOTIATED) == 0) {
+            ngx_http_spdy_init(c->read);
+            return;
+        }
+        }
+#endif
+
         c->log->action = "waiting for request";
 
         c->read->handler = ngx_http_wait_request_handler;
@@ -897,63 +958,85 @@ ngx_http_ssl_servername(ngx_ssl_conn_t *ssl_conn, int *ad, void *arg)
 
 #elif (NGX_POLARSSL)
 
+/*
+ * The certificates, keys and CA chains of all servers are loaded at
+ * configuration time, and the exact and wildcard names of the servers
+ * on the address are already compiled into the virtual_names hash.
+ * The name is resolved with a single probe of that hash: regex names
+ * are not tried, and nothing is allocated from the connection pool.
+ */
+
+#define NGX_HTTP_SSL_SERVERNAME_LEN  255
+
+
 int
 ngx_http_ssl_polarssl_sni(void *arg, ssl_context *ssl_conn,
     const unsigned char *servername, size_t len)
 {
-    ngx_connection_t         *c;
-    ngx_str_t                host;
-    ngx_http_request_t       *r;
-    ngx_http_connection_t    *hc;
-    ngx_http_core_srv_conf_t *cscf;
-    ngx_http_ssl_srv_conf_t  *sscf;
-
-    if (servername == NULL) {
-        return 0;
-    }
+    u_char                     name[NGX_HTTP_SSL_SERVERNAME_LEN];
+    ngx_uint_t                 key;
+    ngx_connection_t          *c;
+    ngx_http_connection_t     *hc;
+    ngx_http_ssl_srv_conf_t   *sscf;
+    ngx_http_core_loc_conf_t  *clcf;
+    ngx_http_core_srv_conf_t  *cscf;
+    ngx_http_virtual_names_t  *vn;
 
     c = arg;
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
-                   "SSL server name: \"%s\"", servername);
+    /* the request is not created yet */
 
-    r = c->data;
-    hc = r->http_connection;
+    hc = c->data;
+    vn = hc->addr_conf->virtual_names;
 
-    host.len = ngx_strlen(servername);
+    if (vn == NULL || servername == NULL) {
+        return 0;
+    }
 
-    len = ngx_http_validate_host(&host, c->pool, 1);
+    if (len && servername[len - 1] == '.') {
+        len--;
+    }
 
-    if (len <= 0) {
+    if (len == 0 || len > NGX_HTTP_SSL_SERVERNAME_LEN
+        || servername[0] == '.'
+        || ngx_strlchr((u_char *) servername, (u_char *) servername + len, '/'))
+    {
         return 0;
     }
 
-    if (ngx_http_find_virtual_server(c, hc->addr_conf->virtual_names, &host,
-                                     NULL, &cscf) 
-            != NGX_OK)
-    {
+    key = ngx_hash_strlow(name, (u_char *) servername, len);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "SSL server name: \"%*s\"", len, name);
+
+    cscf = ngx_hash_find_combined(&vn->names, key, name, len);
+
+    if (cscf == NULL || cscf == hc->addr_conf->default_server) {
         return 0;
     }
 
-    sscf = ngx_http_get_module_srv_conf(r, ngx_http_ssl_module);
+    hc->conf_ctx = cscf->ctx;
 
-    if (sscf->ssl.ctx) {
-        if (sscf->ssl.have_own_cert) {
-            ssl_set_own_cert_rsa(ssl_conn, &sscf->ssl.own_cert, &sscf->ssl.own_key);
-        }
+    clcf = ngx_http_get_module_loc_conf(hc->conf_ctx, ngx_http_core_module);
 
-        if (sscf->ssl.have_ca_cert) {
-            if (sscf->ssl.have_ca_crl) {
-                ssl_set_ca_chain(ssl_conn, &sscf->ssl.ca_cert,
-                                 &sscf->ssl.ca_crl, NULL);
-            } else {
-                ssl_set_ca_chain(ssl_conn, &sscf->ssl.ca_cert, NULL, NULL);
-            }
+    ngx_http_set_connection_log(c, clcf->error_log);
 
-            ssl_set_authmode(ssl_conn, SSL_VERIFY_OPTIONAL);
-        }
+    sscf = ngx_http_get_module_srv_conf(hc->conf_ctx, ngx_http_ssl_module);
+
+    if (sscf->ssl.ctx == NULL) {
+        return 0;
+    }
+
+    if (ngx_ssl_use_certificates(ssl_conn, &sscf->ssl) != NGX_OK) {
+        return -1;
     }
 
+    if (sscf->ssl.have_ca_cert) {
+        ngx_ssl_use_ca_chain(c->ssl, &sscf->ssl);
+    }
+
+    c->ssl->stat = sscf->ssl.stat;
+
     return 0;
 }
 
@@ -3199,6 +3282,12 @@ ngx_http_keepalive_handler(ngx_event_t *rev)
             b->pos = NULL;
         }
 
+#if (NGX_HTTP_SSL)
+        if (c->ssl) {
+            ngx_ssl_free_buffer(c);
+        }
+#endif
+
         return;
     }
 
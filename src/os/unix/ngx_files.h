@@ -382,5 +382,17 @@ extern ngx_uint_t  ngx_file_aio;
 
 #endif
 
+#if (NGX_THREAD_POOL)
+
+ssize_t ngx_thread_read(ngx_file_t *file, u_char *buf, size_t size,
+    off_t offset, ngx_pool_t *pool);
+
+#if (NGX_HAVE_PWRITEV)
+ssize_t ngx_thread_write_chain_to_file(ngx_file_t *file, ngx_chain_t *cl,
+    off_t offset, ngx_pool_t *pool);
+#endif
+
+#endif
+
 
 #endif /* _NGX_FILES_H_INCLUDED_ */
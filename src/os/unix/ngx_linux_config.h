@@ -93,6 +93,18 @@ extern ssize_t sendfile(int s, int fd, int32_t *offset, size_t size);
 #endif
 
 
+#if (NGX_HAVE_IOURING)
+#include <poll.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+
+#if (NGX_HAVE_SYS_EVENTFD_H)
+#include <sys/eventfd.h>
+#endif
+
+
 #if (NGX_HAVE_FILE_AIO)
 #include <sys/syscall.h>
 #include <linux/aio_abi.h>
@@ -100,6 +112,11 @@ typedef struct iocb  ngx_aiocb_t;
 #endif
 
 
+#if (NGX_HAVE_KTLS)
+#include <linux/tls.h>
+#endif
+
+
 #define NGX_LISTEN_BACKLOG        511
 
 
@@ -581,11 +581,17 @@ ngx_unlock_mutexes(ngx_pid_t pid)
 
         sp = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
 
-        if (ngx_shmtx_force_unlock(&sp->mutex, pid)) {
+        if (ngx_slab_force_unlock(sp, pid)) {
             ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
                           "shared memory zone \"%V\" was locked by %P",
                           &shm_zone[i].shm.name, pid);
         }
+
+        /* the locks the zone user keeps inside of the zone */
+
+        if (shm_zone[i].unlock) {
+            shm_zone[i].unlock(&shm_zone[i], pid);
+        }
     }
 }
 